@@ -0,0 +1,25 @@
+# ==============================================================================
+# Author: Yuxuan Zhang (dev@z-yx.cc)
+# License: TBD (UNLICENSED)
+# ==============================================================================
+
+
+def _table() -> list[int]:
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+        table.append(crc)
+    return table
+
+
+TABLE = _table()
+
+
+def crc16(data: bytes) -> int:
+    """CRC-16/X-25, matches the firmware frame check (check value 0x906E)."""
+    crc = 0xFFFF
+    for byte in data:
+        crc = (crc >> 8) ^ TABLE[(crc ^ byte) & 0xFF]
+    return crc ^ 0xFFFF
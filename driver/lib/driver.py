@@ -3,6 +3,9 @@
 # License: TBD (UNLICENSED)
 # ==============================================================================
 
+from os import environ
+from time import sleep
+from struct import unpack
 from threading import Lock, Thread
 from sys import stderr
 from contextlib import contextmanager
@@ -13,8 +16,29 @@ from typing import Callable
 from lib.expect import Expect
 
 from .cobs import COBS
-from .protocol import Method, Prop, encode, decode, PacketChain
-from .stdint import uint8
+from .protocol import (
+    Method,
+    Prop,
+    Integrity,
+    Transport,
+    ConfigKey,
+    Direction,
+    HaltReason,
+    LogLevel,
+    ProgramAction,
+    ProgramEnd,
+    StatKind,
+    StatusKind,
+    encode,
+    decode,
+    pack_moves,
+    packed_count,
+    PacketChain,
+    MOTOR_RANGE,
+)
+from .program import Program
+from .stcp import Port, OVERHEAD as STCP_OVERHEAD
+from .stdint import uint8, uint16, uint32, int32
 from .util import bytes_repr
 
 
@@ -33,9 +57,12 @@ class Driver(Serial):
         pid: int = 0x0070,
         baudrate: int = 115200,
         verbose: int = 0,
+        port: str | None = None,
     ):
         self.verbose = verbose
-        port = locate(vid, pid)
+        # Explicit port (e.g. the pty of a native firmware build) takes
+        # precedence over USB device lookup
+        port = port or environ.get("TSC_SERIAL") or locate(vid, pid)
         if self.verbose:
             print(f"Opening serial device {vid:04X}:{pid:04X} at {port}", file=stderr)
         if port is None:
@@ -55,6 +82,438 @@ class Driver(Serial):
         else:
             return "Unknown Device"
 
+    integrity = Integrity.XOR
+
+    def negotiate(self, integrity: Integrity) -> None:
+        """Switch the frame integrity check, the device resets it to XOR
+        when the port is closed."""
+        config = uint8(ConfigKey.CHECKSUM.value) + uint8(integrity.value)
+        self(
+            Method.SET,
+            Prop.SYS_CFG,
+            config,
+            expect=(Method.ACK, Prop.SYS_CFG, lambda p: p == config),
+        )
+        self.integrity = integrity
+
+    stcp: Port | None = None
+    # SYS_CFG ACK after which the reader switches to STCP
+    _transport: bytes | None = None
+
+    def transport(self, mode: Transport) -> None:
+        """Switch to STCP: frames are then numbered, acknowledged and
+        retransmitted below the protocol, so that requests can be pipelined
+        without application level retries. Lasts until the port is closed."""
+        config = uint8(ConfigKey.TRANSPORT.value) + uint8(mode.value)
+        if mode == Transport.STCP and self.stcp is None:
+            self._transport = config
+        self(
+            Method.SET,
+            Prop.SYS_CFG,
+            config,
+            expect=(Method.ACK, Prop.SYS_CFG, lambda p: p == config),
+        )
+
+    @property
+    def payload_limit(self) -> int:
+        """Largest payload that fits into one frame in the current mode"""
+        limit = 250 - (2 if self.integrity == Integrity.CRC16 else 0)
+        return limit - (STCP_OVERHEAD if self.stcp else 0)
+
+    def log_level(self, level: LogLevel) -> None:
+        """Set the verbosity of the device debug log (on its debug port)."""
+        config = uint8(ConfigKey.LOG_LEVEL.value) + uint8(level.value)
+        self(
+            Method.SET,
+            Prop.SYS_CFG,
+            config,
+            expect=(Method.ACK, Prop.SYS_CFG, lambda p: p == config),
+        )
+
+    def endstop(
+        self,
+        switch: int,
+        motor: int,
+        directions: Direction = Direction(0),
+        invert: bool = False,
+    ) -> None:
+        """Map a limit switch to the motor directions it stops, an empty
+        direction set unmaps it. Changes are reported as SYN SYS_CFG events,
+        see decode_endstop."""
+        config = (
+            uint8(ConfigKey.ENDSTOP.value)
+            + uint8(switch)
+            + uint8(motor)
+            + uint8(directions.value)
+            + uint8(int(invert))
+        )
+        self(
+            Method.SET,
+            Prop.SYS_CFG,
+            config,
+            expect=(Method.ACK, Prop.SYS_CFG, lambda p: p == config),
+        )
+
+    @staticmethod
+    def decode_endstop(packet: PacketChain) -> dict | None:
+        """Switch index, motor id, state and motor position at the change of
+        a SYN SYS_CFG endstop event, None for any other frame."""
+        payload = packet.payload
+        if packet.method != Method.SYN or packet.prop != Prop.SYS_CFG:
+            return None
+        if len(payload) < 8 or payload[0] != ConfigKey.ENDSTOP.value:
+            return None
+        _, switch, motor, active, position = unpack("<BBB?i", payload[:8])
+        return dict(switch=switch, motor=motor, active=active, position=position)
+
+    def stall_abort(self, motor: int, enable: bool = True) -> None:
+        """Abort the queue of a motor when StallGuard reports a stall during
+        a move. Stalls are reported as MOT_MOV range REJ frames with reason
+        HaltReason.STALL, see decode_halt."""
+        config = uint8(ConfigKey.STALL.value) + uint8(motor) + uint8(int(enable))
+        self(
+            Method.SET,
+            Prop.SYS_CFG,
+            config,
+            expect=(Method.ACK, Prop.SYS_CFG, lambda p: p == config),
+        )
+
+    def home(self, motor: int, travel: int, interval: int, backoff: int) -> None:
+        """Queue sensorless homing: run toward a stall for at most `travel`
+        steps (signed) at one step per `interval` us, back off `backoff`
+        steps and zero the position. Does not wait for completion, which is
+        acknowledged as a MOT_MOV range."""
+        self(
+            Method.SET,
+            Prop.MOT_HOME,
+            uint8(motor) + int32(travel) + uint32(interval) + int32(backoff),
+        )
+
+    def queue_moves(self, moves) -> int:
+        """Queue (motor, steps, interval) moves in as few frames as possible,
+        packed (see pack_moves). Does not wait for the ACKs, which arrive as
+        MOT_MOV ranges. Returns the number of frames sent."""
+        payloads = pack_moves(moves, self.payload_limit)
+        for payload in payloads:
+            self(Method.SET, Prop.MOT_MOV, payload)
+        return len(payloads)
+
+    @staticmethod
+    def credits(packet: PacketChain) -> int | None:
+        """Free command slots (shared by all motors) reported by a MOT_MOV
+        range or MOT_QUE frame (reply or watermark event), None for any other
+        frame."""
+        payload = packet.payload
+        if packet.prop == Prop.MOT_MOV and packet.method in (Method.ACK, Method.REJ):
+            if len(payload) >= 8 and payload[0] == MOTOR_RANGE:
+                return unpack("<H", payload[6:8])[0]
+        elif packet.prop == Prop.MOT_QUE and packet.method in (Method.ACK, Method.SYN):
+            if len(payload) >= 5:
+                return unpack("<H", payload[3:5])[0]
+        return None
+
+    @staticmethod
+    def decode_halt(packet: PacketChain) -> dict | None:
+        """Motor, reason (HaltReason) and stop position of a MOT_MOV range
+        REJ, sent when the queue of a motor is dropped. None for any other
+        frame."""
+        payload = packet.payload
+        if packet.method != Method.REJ or packet.prop != Prop.MOT_MOV:
+            return None
+        if len(payload) < 13 or payload[0] != MOTOR_RANGE:
+            return None
+        reason, position = unpack("<Bi", payload[8:13])
+        return dict(motor=payload[1], reason=HaltReason(reason), position=position)
+
+    def stream_moves(self, moves, timeout: float = 5.0) -> int:
+        """Queue (motor, steps, interval) moves like queue_moves, but never
+        more than the device has room for. Credits are the free slots of the
+        latest MOT_MOV range or MOT_QUE frame, less the moves of frames the
+        device had not taken in when it reported them. Frames are handled in
+        order, so every frame sent before the one a report answers is
+        already accounted for in its credits; a MOT_QUE probe is sent
+        whenever a frame does not fit to learn that early. Frames rejected
+        for a full queue are sent again. Returns the number of frames sent,
+        raises TimeoutError if no credit arrives within `timeout` seconds."""
+        rx = self.rx
+        payloads = pack_moves(moves, self.payload_limit)
+        total = len(payloads)
+        # [sequence, moves, payload, taken] of frames not answered yet, in
+        # order. Probes carry no payload. MOT_MOV frames are answered once
+        # their last move is picked up, long after they were taken in.
+        inflight: list[list] = []
+        credits = 0
+
+        def probe():
+            # Answered once every frame sent before it has been handled
+            self(Method.GET, Prop.MOT_QUE, uint8(0))
+            inflight.append([self.sequence, 0, None, False])
+
+        probe()
+        while payloads or inflight:
+            used = sum(n for _, n, _, taken in inflight if not taken)
+            if payloads and credits - used >= packed_count(payloads[0]):
+                payload = payloads.pop(0)
+                self(Method.SET, Prop.MOT_MOV, payload)
+                inflight.append([self.sequence, packed_count(payload), payload, False])
+                if not payloads:
+                    probe()
+                continue
+            if not inflight:
+                # Queue taken by someone else, nothing left to report on it
+                sleep(0.01)
+                probe()
+            elif used and all(entry[2] is not None for entry in inflight):
+                # Learn how many of the frames sent so far were taken in,
+                # otherwise room only frees up as range ACKs arrive
+                probe()
+            for packet in rx(timeout):
+                if packet is not rx:
+                    rx = packet
+                    break
+            else:
+                raise TimeoutError(f"No reply from the device within {timeout}s")
+            free = self.credits(packet)
+            if free is not None:
+                credits = free
+            sequences = [entry[0] for entry in inflight]
+            if packet.sequence == 0 or packet.sequence not in sequences:
+                continue
+            # Frames are handled in order: the ones sent before this one are
+            # in the credits just reported, earlier probes were answered
+            index = sequences.index(packet.sequence)
+            answered = inflight.pop(index)
+            for entry in inflight[:index]:
+                entry[3] = True
+            inflight[:index] = [e for e in inflight[:index] if e[2] is not None]
+            if packet.method != Method.REJ:
+                continue
+            halt = self.decode_halt(packet)
+            if halt is not None:
+                raise RuntimeError(f"Moves rejected: {halt['reason'].name}")
+            if not packet.payload.startswith(b"Motor Queue Full"):
+                raise RuntimeError(packet.payload.decode(errors="replace"))
+            # Sent again once a fresh report tells there is room
+            payloads.insert(0, answered[2])
+            probe()
+        return total
+
+    def queue_status(self, motor: int) -> dict:
+        """Commands pending on `motor`, free and total command slots shared
+        by all motors (a single busy motor may take all of them), and the
+        watermarks of `motor`."""
+        payload = self(
+            Method.GET,
+            Prop.MOT_QUE,
+            uint8(motor),
+            expect=(Method.ACK, Prop.MOT_QUE, lambda p: p[:1] == uint8(motor)),
+        )
+        _, queued, free, capacity, low, high = unpack("<BHHHHH", payload)
+        return dict(queued=queued, free=free, capacity=capacity, low=low, high=high)
+
+    def positions(self) -> tuple[int, list[tuple[int, int]]]:
+        """Device time (us) and (position, velocity) in steps and steps/s of
+        every motor, indexed by motor id."""
+        payload = self(
+            Method.GET,
+            Prop.MOT_STAT,
+            uint8(StatusKind.POSITION.value),
+            expect=(Method.ACK, Prop.MOT_STAT, lambda p: len(p) == 29),
+        )
+        return Driver.decode_positions(payload)
+
+    @staticmethod
+    def decode_positions(payload: bytes) -> tuple[int, list[tuple[int, int]]]:
+        _, time, *axes = unpack("<BI6i", payload)
+        return time, [(axes[i], axes[i + 1]) for i in range(0, 6, 2)]
+
+    def stream_positions(self, period: int) -> None:
+        """Let the device push positions as SYN MOT_STAT every `period` ms,
+        0 stops the stream."""
+        request = uint8(StatusKind.POSITION.value) + uint16(period)
+        self(
+            Method.SET,
+            Prop.MOT_STAT,
+            request,
+            expect=(Method.ACK, Prop.MOT_STAT, lambda p: p == request),
+        )
+
+    def driver_status(self) -> tuple[int, list[dict]]:
+        """Device time (us) and the latest TMC2209 health readings of every
+        motor, indexed by motor id. Only the stream triggers fresh reads."""
+        payload = self(
+            Method.GET,
+            Prop.MOT_STAT,
+            uint8(StatusKind.DRIVER.value),
+            expect=(Method.ACK, Prop.MOT_STAT, lambda p: len(p) == 36),
+        )
+        return Driver.decode_driver_status(payload)
+
+    @staticmethod
+    def decode_driver_status(payload: bytes) -> tuple[int, list[dict]]:
+        _, time, online, *regs = unpack("<BIB" + "IHI" * 3, payload)
+        drivers = []
+        for i in range(3):
+            drv_status, sg_result, tstep = regs[3 * i : 3 * i + 3]
+            drivers.append(
+                {
+                    "online": bool(online >> i & 1),
+                    "drv_status": drv_status,
+                    # Temperature: pre-warning, shutdown, thresholds passed
+                    "otpw": bool(drv_status & 1 << 0),
+                    "ot": bool(drv_status & 1 << 1),
+                    "temperature": max(
+                        (t for b, t in ((8, 120), (9, 143), (10, 150), (11, 157))
+                         if drv_status & 1 << b),
+                        default=None,
+                    ),
+                    "short": bool(drv_status & 0b1111 << 2),
+                    "open_load": bool(drv_status & 0b11 << 6),
+                    "cs_actual": drv_status >> 16 & 0x1F,
+                    "stealth": bool(drv_status & 1 << 30),
+                    "standstill": bool(drv_status & 1 << 31),
+                    "sg_result": sg_result,
+                    "tstep": tstep,
+                }
+            )
+        return time, drivers
+
+    def stream_driver_status(self, period: int) -> None:
+        """Let the device read all enabled drivers every `period` ms and push
+        the results as SYN MOT_STAT, 0 stops the stream."""
+        request = uint8(StatusKind.DRIVER.value) + uint16(period)
+        self(
+            Method.SET,
+            Prop.MOT_STAT,
+            request,
+            expect=(Method.ACK, Prop.MOT_STAT, lambda p: p == request),
+        )
+
+    def load_program(self, program: Program) -> None:
+        """Replace the program stored on the device (not while running)"""
+        for offset, code in program.chunks():
+            self(
+                Method.SET,
+                Prop.MOT_PROG,
+                uint8(ProgramAction.LOAD.value) + uint16(offset) + code,
+                expect=(Method.ACK, Prop.MOT_PROG),
+            )
+
+    def run_program(self, entry: int = 0) -> dict:
+        """Start the stored program, its end is reported as a SYN MOT_PROG
+        event, see decode_program_end"""
+        payload = self(
+            Method.SET,
+            Prop.MOT_PROG,
+            uint8(ProgramAction.RUN.value) + uint16(entry),
+            expect=(Method.ACK, Prop.MOT_PROG),
+        )
+        return Driver.decode_program_status(payload)
+
+    def stop_program(self) -> dict:
+        """Stop the program and halt the motion it still has queued"""
+        payload = self(
+            Method.SET,
+            Prop.MOT_PROG,
+            uint8(ProgramAction.STOP.value),
+            expect=(Method.ACK, Prop.MOT_PROG),
+        )
+        return Driver.decode_program_status(payload)
+
+    def store_program(self, slot: int, program: Program) -> None:
+        """Replace the program in a storage slot, kept across power cycles"""
+        for offset, code in program.chunks():
+            self(
+                Method.SET,
+                Prop.MOT_PROG,
+                uint8(ProgramAction.STORE.value) + uint8(slot) + uint16(offset) + code,
+                expect=(Method.ACK, Prop.MOT_PROG),
+            )
+
+    def play_program(self, slot: int, entry: int = 0) -> dict:
+        """Same as run_program(), on a stored program"""
+        payload = self(
+            Method.SET,
+            Prop.MOT_PROG,
+            uint8(ProgramAction.PLAY.value) + uint8(slot) + uint16(entry),
+            expect=(Method.ACK, Prop.MOT_PROG),
+        )
+        return Driver.decode_program_status(payload)
+
+    def erase_program(self, slot: int) -> None:
+        self(
+            Method.SET,
+            Prop.MOT_PROG,
+            uint8(ProgramAction.ERASE.value) + uint8(slot),
+            expect=(Method.ACK, Prop.MOT_PROG),
+        )
+
+    def stored_programs(self) -> dict:
+        """Storage usage (bytes) and the size of every non-empty slot"""
+        payload = self(
+            Method.GET,
+            Prop.MOT_PROG,
+            uint8(ProgramAction.STORE.value),
+            expect=(Method.ACK, Prop.MOT_PROG, lambda p: len(p) == 137),
+        )
+        _, total, used, *sizes = unpack("<BII64H", payload)
+        return dict(
+            total=total,
+            used=used,
+            slots={slot: size for slot, size in enumerate(sizes) if size},
+        )
+
+    def program_status(self) -> dict:
+        payload = self(Method.GET, Prop.MOT_PROG, expect=(Method.ACK, Prop.MOT_PROG))
+        return Driver.decode_program_status(payload)
+
+    @staticmethod
+    def decode_program_status(payload: bytes) -> dict:
+        running, source, pc, size, capacity, issued = unpack("<?BHHHI", payload)
+        return dict(
+            running=running,
+            source=None if source == 0xFF else source,
+            pc=pc,
+            size=size,
+            capacity=capacity,
+            issued=issued,
+        )
+
+    @staticmethod
+    def decode_program_end(packet: PacketChain) -> dict | None:
+        """Program status (see decode_program_status) and reason (ProgramEnd)
+        of a SYN MOT_PROG event, None for any other frame."""
+        payload = packet.payload
+        if packet.method != Method.SYN or packet.prop != Prop.MOT_PROG:
+            return None
+        if len(payload) < 13:
+            return None
+        status = Driver.decode_program_status(payload[:12])
+        return dict(status, reason=ProgramEnd(payload[12]))
+
+    def stat(self, kind: StatKind, id: int = 0, reset: bool = False) -> dict:
+        """Read a timing histogram, optionally resetting it. Bucket 0 counts
+        zeros, bucket i counts values in [2^(i-1), 2^i), the last bucket also
+        counts everything above."""
+        payload = self(
+            Method.SET if reset else Method.GET,
+            Prop.SYS_STAT,
+            uint8(kind.value) + uint8(id),
+            expect=(
+                Method.ACK,
+                Prop.SYS_STAT,
+                lambda p: p[:2] == uint8(kind.value) + uint8(id),
+            ),
+        )
+        _, _, count, low, high, total, *buckets = unpack("<BBIIIQ16I", payload)
+        return dict(
+            count=count,
+            min=low,
+            max=high,
+            mean=total / count if count else 0,
+            buckets=buckets,
+        )
+
     @contextmanager
     def enable(self):
         if not self.is_open:
@@ -76,6 +535,12 @@ class Driver(Serial):
             )
 
     tx_lock = Lock()
+    # Sequence 0 is reserved for unsolicited frames, which are never ACKed
+    sequence = 0
+
+    def next_sequence(self) -> int:
+        self.sequence = self.sequence % 0xFFFF + 1
+        return self.sequence
 
     def __call__(
         self,
@@ -88,16 +553,26 @@ class Driver(Serial):
         retry_interval: float = 0.5,
     ) -> bytes:
         rx = self.rx
+        sent = False
         while True:
-            if self.verbose:
-                _args = b"".join(args)
-                print(
-                    f"[DRV] << {method.name}::{prop.name} [{bytes_repr(_args)}] ({len(_args)} bytes)",
-                    file=stderr,
+            # Under STCP the transport retransmits, sending again would
+            # duplicate the request
+            if not (sent and self.stcp):
+                if self.verbose:
+                    _args = b"".join(args)
+                    print(
+                        f"[DRV] << {method.name}::{prop.name} [{bytes_repr(_args)}] ({len(_args)} bytes)",
+                        file=stderr,
+                    )
+                packet = encode(
+                    method,
+                    prop,
+                    *args,
+                    sequence=self.next_sequence(),
+                    integrity=self.integrity,
                 )
-            packet = encode(method, prop, *args)
-            self.write(COBS.encode(packet))
-            self.flush()
+                self.transmit(packet)
+                sent = True
             if expect is None:
                 return b""
             if len(expect) == 2:
@@ -108,6 +583,8 @@ class Driver(Serial):
             else:
                 raise ValueError(f"Invalid expect format: {expect}")
             for next in rx(retry_interval):
+                if next is rx:
+                    continue  # Received before this request was sent
                 rx = next
                 if m == rx.method and p == rx.prop and check(rx.payload):
                     return rx.payload
@@ -117,51 +594,92 @@ class Driver(Serial):
                         file=stderr,
                     )
 
+    def transmit(self, packet: bytes) -> None:
+        if self.stcp:
+            # Leaves through the reader thread as the window allows
+            self.stcp.send(packet)
+            return
+        with self.tx_lock:
+            self.write(COBS.encode(packet))
+            self.flush()
+
+    def pending(self) -> int:
+        """Frames sent but not yet acknowledged by the transport (STCP only,
+        always 0 otherwise)"""
+        return self.stcp.pending if self.stcp else 0
+
     rx_buffer: bytes = b""
 
-    def recv(self):
+    def recv(self) -> list[tuple[Method, Prop, bytes, int]]:
         data = self.read(size=128)
         if data and self.verbose >= 3:
             print(f"[DRV] >>", bytes_repr(data), file=stderr)
         self.rx_buffer += data
         frame, self.rx_buffer = COBS.decode(self.rx_buffer)
         if frame is None:
-            return None
-        if self.verbose >= 3:
-            preview = frame[2:].decode("ascii", errors="replace")
-            print(f'      >> "{preview}"', file=stderr)
-        try:
-            packet = decode(frame)
-            if packet is None:
-                print(f"Invalid frame: {bytes_repr(frame)}", file=stderr)
-            return packet
-        except ValueError as e:
-            print(f"Decoding error: {e} for frame {bytes_repr(frame)}", file=stderr)
-            return None
+            return []
+        frames = [frame]
+        if self.stcp:
+            frames = self.stcp.input(frame)
+            if frames is None:
+                print(f"Invalid segment: {bytes_repr(frame)}", file=stderr)
+                return []
+        packets = []
+        for frame in frames:
+            if self.verbose >= 3:
+                preview = frame[4:].decode("ascii", errors="replace")
+                print(f'      >> "{preview}"', file=stderr)
+            try:
+                packet = decode(frame, self.integrity)
+                if packet is None:
+                    print(f"Invalid frame: {bytes_repr(frame)}", file=stderr)
+                else:
+                    packets.append(packet)
+            except ValueError as e:
+                print(f"Decoding error: {e} for frame {bytes_repr(frame)}", file=stderr)
+        return packets
 
     rx = PacketChain(Method.NOP, Prop.NA, b"")
     _sig_term = False
 
     def reader(self):
         while not self._sig_term:
-            packet = self.recv()
-            if packet is None:
-                continue
-            method, prop, payload = packet
-            if method == Method.LOG:
-                print(
-                    f"[LOG] >> {payload.decode('ascii', errors='replace')}",
-                    file=stderr,
-                )
-            else:
-                rx = self.rx
-                self.rx = PacketChain(method, prop, payload)
-                rx.next = self.rx
-                if self.verbose:
-                    print("[DRV] >>", self.rx, file=stderr)
+            for packet in self.recv():
+                self.dispatch(*packet)
+            if self.stcp:
+                segments = self.stcp.poll()
+                if segments:
+                    with self.tx_lock:
+                        self.write(b"".join(COBS.encode(s) for s in segments))
+                        self.flush()
         # Signal termination to iterators
         self.rx.next = PacketChain.FLAG_TERM
 
+    def dispatch(
+        self, method: Method, prop: Prop, payload: bytes, sequence: int = 0
+    ) -> None:
+        if method == Method.LOG:
+            print(
+                f"[LOG] >> {payload.decode('ascii', errors='replace')}",
+                file=stderr,
+            )
+            return
+        # Frames after this ACK are STCP segments, switch before the next one
+        # is decoded
+        if (
+            self._transport is not None
+            and method == Method.ACK
+            and prop == Prop.SYS_CFG
+            and payload == self._transport
+        ):
+            self._transport = None
+            self.stcp = Port()
+        rx = self.rx
+        self.rx = PacketChain(method, prop, payload, sequence)
+        rx.next = self.rx
+        if self.verbose:
+            print("[DRV] >>", self.rx, file=stderr)
+
     def close(self):
         self._sig_term = True
         self.reader_thread.join()
@@ -0,0 +1,83 @@
+# ==============================================================================
+# Author: Yuxuan Zhang (dev@z-yx.cc)
+# License: TBD (UNLICENSED)
+# ==============================================================================
+
+from enum import Enum
+from .stdint import uint8, uint16, uint32, int32
+
+
+class Program:
+    """Motion program (MOT_PROG) assembler. Every method appends one
+    instruction and returns its index, usable as a jump target:
+
+        p = Program()
+        start = p.move(0, 1000, 50)
+        p.move(0, -1000, 50)
+        p.loop(start, 5000)
+        p.halt()
+    """
+
+    class Op(Enum):
+        HALT = 0x00
+        JUMP = 0x01
+        LOOP = 0x02
+        DELAY = 0x03
+        MOVE = 0x04
+        SEGMENT = 0x05
+        SYNC = 0x06
+
+    # Opcode followed by the largest operand (Segment)
+    INSTRUCTION_SIZE = 17
+    # Instructions per PROG_LOAD frame (action + offset, 250 bytes payload)
+    CHUNK = (250 - 3) // INSTRUCTION_SIZE
+
+    def __init__(self):
+        self.code: list[bytes] = []
+
+    def __len__(self):
+        return len(self.code)
+
+    @property
+    def here(self) -> int:
+        """Index of the next instruction"""
+        return len(self.code)
+
+    def emit(self, op: Op, operand: bytes = b"") -> int:
+        self.code.append(uint8(op.value) + operand.ljust(self.INSTRUCTION_SIZE - 1, b"\0"))
+        return len(self.code) - 1
+
+    def halt(self) -> int:
+        return self.emit(Program.Op.HALT)
+
+    def jump(self, target: int) -> int:
+        return self.emit(Program.Op.JUMP, uint16(target))
+
+    def loop(self, target: int, count: int = 0) -> int:
+        """Jump back to `target` until the body ran `count` times in total,
+        0 repeats forever"""
+        if not (0 <= count < 65536):
+            raise ValueError(f"Loop count {count} out of range")
+        return self.emit(Program.Op.LOOP, uint16(target) + uint16(count))
+
+    def delay(self, us: int) -> int:
+        """All enabled motors hold still for `us`, in sync"""
+        return self.emit(Program.Op.DELAY, uint32(us))
+
+    def move(self, motor: int, steps: int, interval: int) -> int:
+        return self.emit(Program.Op.MOVE, uint8(motor) + int32(steps) + uint32(interval))
+
+    def segment(self, steps: tuple[int, int, int], duration: int) -> int:
+        """Coordinated move of all enabled motors over `duration` us"""
+        return self.emit(
+            Program.Op.SEGMENT, b"".join(int32(s) for s in steps) + uint32(duration)
+        )
+
+    def sync(self) -> int:
+        """Barrier across all enabled motors"""
+        return self.emit(Program.Op.SYNC)
+
+    def chunks(self):
+        """(offset, instructions) pairs, one per PROG_LOAD frame"""
+        for offset in range(0, len(self.code), self.CHUNK):
+            yield offset, b"".join(self.code[offset : offset + self.CHUNK])
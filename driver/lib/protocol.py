@@ -3,10 +3,11 @@
 # License: TBD (UNLICENSED)
 # ==============================================================================
 
-from enum import Enum
+from enum import Enum, Flag
 from sys import stderr
 from time import time as now, sleep
 
+from lib.crc import crc16
 from lib.util import bytes_repr
 
 METHOD_MASK = 0xF0
@@ -37,15 +38,194 @@ class Prop(Enum):
     MOT_MOV = 0x4
     MOT_HOME = 0x5
     MOT_STAT = 0x6
-    LED_PROG = 0xA
+    MOT_RMP = 0x7
+    MOT_QUE = 0x8
+    SYS_STAT = 0x9
+    MOT_PROG = 0xA
     ODOM_SENSOR = 0xB
     COLOR_SENSOR = 0xC
+    SYS_CFG = 0xD
+    BARRIER = 0xE
     FW_INFO = 0xF
 
 
+class Integrity(Enum):
+    # Header checksum byte is the XOR of all other bytes
+    XOR = 0x00
+    # Header checksum byte is zero, frame is followed by its CRC-16 (LE)
+    CRC16 = 0x01
+
+
+class Transport(Enum):
+    # One frame per COBS packet
+    RAW = 0x00
+    # Windowed reliable transport, see lib/stcp.py
+    STCP = 0x01
+
+
+class ConfigKey(Enum):
+    CHECKSUM = 0x01
+    LOG_LEVEL = 0x02
+    ENDSTOP = 0x03
+    STALL = 0x04
+    TRANSPORT = 0x05
+
+
+class Direction(Flag):
+    # Step directions an endstop blocks
+    FORWARD = 0b01
+    BACKWARD = 0b10
+
+
+class StatusKind(Enum):
+    # Absolute position and velocity of all motors
+    POSITION = 0x01
+    # TMC2209 DRV_STATUS, SG_RESULT and TSTEP of all motors
+    DRIVER = 0x02
+
+
+class ProgramAction(Enum):
+    # Write instructions at an offset (0 or the end of the program)
+    LOAD = 0x01
+    # Start from an entry point
+    RUN = 0x02
+    # Stop, and halt the motion of the program still queued
+    STOP = 0x03
+    # Write instructions into a storage slot (flash)
+    STORE = 0x04
+    # Run a stored program, streamed from flash
+    PLAY = 0x05
+    # Empty a storage slot
+    ERASE = 0x06
+
+
+class ProgramEnd(Enum):
+    # Why a program ended, carried by the SYN MOT_PROG event
+    HALT = 0x01
+    STOPPED = 0x02
+    DISCONNECTED = 0x03
+    # A motor it drives was halted (see HaltReason) or is disabled
+    MOTOR_HALTED = 0x04
+    MOTOR_DISABLED = 0x05
+    READ_ERROR = 0x06
+    BAD_INSTRUCTION = 0x07
+    BAD_TARGET = 0x08
+    TOO_DEEP = 0x09
+
+
+class StatKind(Enum):
+    # Duration of each ISR invocation, CPU cycles
+    ISR_TIME = 0x01
+    # Time between ISR invocations while busy, us
+    ISR_PERIOD = 0x02
+    # Step edge time past its schedule, per motor, us
+    LATENESS = 0x03
+
+
+class LogLevel(Enum):
+    # Verbosity of the binary debug log (see scripts/debug-log.py)
+    SILENT = 0
+    ERROR = 1
+    WARNING = 2
+    INFO = 3
+    VERBOSE = 4
+
+
+class HaltReason(Enum):
+    # Why the queue of a motor was dropped, follows the range of a REJ
+    ENDSTOP = 0x01
+    STALL = 0x02
+    HOMING_FAILED = 0x03
+    # Stopped by the program it belonged to
+    STOPPED = 0x04
+    DISABLED = 0x05
+
+
+# Leads the payload of ACK / REJ MOT_MOV range frames, never the first byte of
+# the text carried by plain rejections
+MOTOR_RANGE = 0xFE
+
+# Leads a SET MOT_MOV payload of packed moves (see pack_moves)
+MOVE_PACKED = 0xFF
+PACKED_SAME_STEPS = 0x04
+PACKED_SAME_INTERVAL = 0x08
+
+
+def varint(delta: int) -> bytes:
+    """Zigzag LEB128 of a 32 bit (wrapping) difference"""
+    delta &= 0xFFFFFFFF
+    if delta & 0x80000000:
+        delta -= 1 << 32
+    raw = ((delta << 1) ^ (delta >> 31)) & 0xFFFFFFFF
+    out = bytearray()
+    while raw > 0x7F:
+        out.append(raw & 0x7F | 0x80)
+        raw >>= 7
+    out.append(raw)
+    return bytes(out)
+
+
+def pack_moves(moves, limit: int = 250) -> list[bytes]:
+    """Packed MOT_MOV payloads for (motor, steps, interval) moves, in order,
+    each at most `limit` bytes. Moves are delta encoded against the previous
+    move of the same motor in the same payload."""
+    payloads: list[bytes] = []
+    payload = bytearray([MOVE_PACKED])
+    previous: dict[int, tuple[int, int]] = {}
+    for motor, steps, interval in moves:
+        while True:
+            last_steps, last_interval = previous.get(motor, (0, 0))
+            record = bytearray([motor & 0x03])
+            if steps == last_steps:
+                record[0] |= PACKED_SAME_STEPS
+            else:
+                record += varint(steps - last_steps)
+            if interval == last_interval:
+                record[0] |= PACKED_SAME_INTERVAL
+            else:
+                record += varint(interval - last_interval)
+            if len(payload) + len(record) <= limit:
+                break
+            # Next payload starts over from zero
+            payloads.append(bytes(payload))
+            payload = bytearray([MOVE_PACKED])
+            previous = {}
+        payload += record
+        previous[motor] = (steps, interval)
+    if len(payload) > 1:
+        payloads.append(bytes(payload))
+    return payloads
+
+
+def packed_count(payload: bytes) -> int:
+    """Number of moves in a packed MOT_MOV payload (see pack_moves)"""
+    count, i = 0, 1
+    while i < len(payload):
+        tag = payload[i]
+        i += 1
+        for flag in (PACKED_SAME_STEPS, PACKED_SAME_INTERVAL):
+            if not tag & flag:
+                while payload[i] & 0x80:
+                    i += 1
+                i += 1
+        count += 1
+    return count
+
+
 @staticmethod
-def encode(method: Method, prop: Prop, *data: bytes) -> bytes:
-    payload = bytearray([0, method.value | prop.value, *b"".join(data)])
+def encode(
+    method: Method,
+    prop: Prop,
+    *data: bytes,
+    sequence: int = 0,
+    integrity: Integrity = Integrity.XOR,
+) -> bytes:
+    # Header: checksum, sequence (uint16 LE), method | prop
+    payload = bytearray(
+        [0, sequence & 0xFF, sequence >> 8, method.value | prop.value, *b"".join(data)]
+    )
+    if integrity == Integrity.CRC16:
+        return bytes(payload) + crc16(payload).to_bytes(2, "little")
     # XOR all bytes in the payload with the first byte
     for byte in payload[1:]:
         payload[0] ^= byte
@@ -53,21 +233,31 @@ def encode(method: Method, prop: Prop, *data: bytes) -> bytes:
 
 
 @staticmethod
-def decode(frame: bytes) -> tuple[Method, Prop, bytes] | None:
-    if len(frame) < 2:
-        return None
-
-    checksum = frame[0]
-
-    # Verify checksum
-    for byte in frame[1:]:
-        checksum ^= byte
-
-    if checksum != 0:
-        print(f"Frame Dropped: bad checksum 0x{checksum:02x}", file=stderr)
-        return None
-
-    code = frame[1]
+def decode(
+    frame: bytes, integrity: Integrity = Integrity.XOR
+) -> tuple[Method, Prop, bytes, int] | None:
+    if integrity == Integrity.CRC16:
+        if len(frame) < 6:
+            return None
+        frame, trailer = frame[:-2], int.from_bytes(frame[-2:], "little")
+        if frame[0] != 0 or crc16(frame) != trailer:
+            print(f"Frame Dropped: bad CRC 0x{trailer:04x}", file=stderr)
+            return None
+    else:
+        if len(frame) < 4:
+            return None
+
+        checksum = frame[0]
+
+        # Verify checksum
+        for byte in frame[1:]:
+            checksum ^= byte
+
+        if checksum != 0:
+            print(f"Frame Dropped: bad checksum 0x{checksum:02x}", file=stderr)
+            return None
+
+    code = frame[3]
     try:
         method = Method(code & METHOD_MASK)
         prop = Prop(code & PROP_MASK)
@@ -75,9 +265,10 @@ def decode(frame: bytes) -> tuple[Method, Prop, bytes] | None:
         print(f"Bad frame header 0x{code:02x}", file=stderr)
         return None
 
-    payload = frame[2:]
+    payload = frame[4:]
+    sequence = frame[1] | frame[2] << 8
 
-    return method, prop, bytes(payload)
+    return method, prop, bytes(payload), sequence
 
 
 class PacketChain:
@@ -86,6 +277,8 @@ class PacketChain:
     method: Method
     prop: Prop
     payload: bytes
+    # Sequence of the request answered, 0 for unsolicited frames
+    sequence: int
 
     # Lock-free linked list for chaining packets
     # next is read-only for consumers,
@@ -97,10 +290,12 @@ class PacketChain:
         method: Method,
         prop: Prop,
         payload: bytes = b"",
+        sequence: int = 0,
     ):
         self.method = method
         self.prop = prop
         self.payload = payload
+        self.sequence = sequence
 
     def __call__(self, timeout: float | None = None) -> "PacketChain.Iterator":
         if timeout is not None:
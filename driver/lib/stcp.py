@@ -0,0 +1,143 @@
+# ==============================================================================
+# Author: Yuxuan Zhang (dev@z-yx.cc)
+# License: TBD (UNLICENSED)
+# ==============================================================================
+# Serial Transport Control Protocol (STCP), host end. Mirrors
+# firmware/lib/stcp: each COBS frame carries one segment
+#   type u8 | sequence u8 | sack u8 | body | CRC-16/X-25 (LE)
+# DATA segments are numbered modulo 256 and delivered in order exactly once,
+# ACKs carry the next sequence expected and a bitmask of the segments held
+# beyond it.
+# ==============================================================================
+
+from collections import deque
+from enum import Enum
+from threading import Lock
+from time import monotonic
+
+from .crc import crc16
+
+HEADER_SIZE = 3
+OVERHEAD = HEADER_SIZE + 2
+
+
+class PacketType(Enum):
+    DATA = 0x00
+    ACK = 0x01
+
+
+def seal(type: PacketType, sequence: int, sack: int, body: bytes = b"") -> bytes:
+    segment = bytes([type.value, sequence & 0xFF, sack]) + body
+    return segment + crc16(segment).to_bytes(2, "little")
+
+
+class Port:
+    # Segments in flight, must not exceed the device window
+    WINDOW = 8
+    # Retransmission timeout and least time between two retransmissions of
+    # the same segment requested by a SACK (s)
+    RTO = 0.1
+    HOLDOFF = 0.02
+
+    def __init__(self):
+        self.lock = Lock()
+        # Bodies waiting for the window, unbounded
+        self.backlog: deque[bytes] = deque()
+        # Sequence -> [segment, sent, acked, lost], from base to fresh
+        self.flight: dict[int, list] = {}
+        self.base = self.fresh = 0
+        # Bodies received beyond a gap, by sequence
+        self.held: dict[int, bytes] = {}
+        self.expected = 0
+        self.ack_due = False
+        self.retransmitted = self.duplicates = 0
+
+    @property
+    def pending(self) -> int:
+        """Bodies not yet acknowledged by the device"""
+        with self.lock:
+            return len(self.backlog) + len(self.flight)
+
+    def send(self, body: bytes) -> None:
+        with self.lock:
+            self.backlog.append(body)
+
+    def input(self, segment: bytes) -> list[bytes] | None:
+        """Process a decoded segment, returns the bodies now deliverable in
+        order (maybe none), or None if the segment is corrupted"""
+        if len(segment) < OVERHEAD:
+            return None
+        if crc16(segment[:-2]) != int.from_bytes(segment[-2:], "little"):
+            return None
+        type, sequence, sack = segment[:HEADER_SIZE]
+        with self.lock:
+            if type == PacketType.ACK.value:
+                self._acknowledged(sequence, sack)
+                return []
+            if type != PacketType.DATA.value:
+                return None
+            # Duplicates are dropped, but acknowledged again in case the
+            # previous ACK was lost
+            self.ack_due = True
+            if (sequence - self.expected) & 0xFF >= self.WINDOW or (
+                sequence in self.held
+            ):
+                self.duplicates += 1
+                return []
+            self.held[sequence] = segment[HEADER_SIZE:-2]
+            delivered = []
+            while self.expected in self.held:
+                delivered.append(self.held.pop(self.expected))
+                self.expected = (self.expected + 1) & 0xFF
+            return delivered
+
+    def _acknowledged(self, ack: int, sack: int) -> None:
+        flight = (self.fresh - self.base) & 0xFF
+        # Stale (reordered) or bogus ACKs would move the window backwards
+        if (ack - self.base) & 0xFF > flight:
+            return
+        while self.base != ack:
+            del self.flight[self.base]
+            self.base = (self.base + 1) & 0xFF
+        last = self.base
+        for i in range(8):
+            sequence = (ack + 1 + i) & 0xFF
+            if sack >> i & 1 and sequence in self.flight:
+                self.flight[sequence][2] = True
+                last = sequence
+        # Everything below the last segment received is missing, unless it
+        # was just sent again
+        time = monotonic()
+        sequence = self.base
+        while sequence != last:
+            entry = self.flight[sequence]
+            if not entry[2] and time - entry[1] >= self.HOLDOFF:
+                entry[3] = True
+            sequence = (sequence + 1) & 0xFF
+
+    def poll(self) -> list[bytes]:
+        """Segments to transmit now: the ACK if one is due, retransmissions
+        and new data as far as the window allows"""
+        segments = []
+        time = monotonic()
+        with self.lock:
+            if self.ack_due:
+                self.ack_due = False
+                sack = 0
+                for i in range(1, self.WINDOW):
+                    if (self.expected + i) & 0xFF in self.held:
+                        sack |= 1 << (i - 1)
+                segments.append(seal(PacketType.ACK, self.expected, sack))
+            for entry in self.flight.values():
+                segment, sent, acked, lost = entry
+                if acked or not (lost or time - sent >= self.RTO):
+                    continue
+                entry[1], entry[3] = time, False
+                self.retransmitted += 1
+                segments.append(segment)
+            while self.backlog and len(self.flight) < self.WINDOW:
+                segment = seal(PacketType.DATA, self.fresh, 0, self.backlog.popleft())
+                self.flight[self.fresh] = [segment, time, False, False]
+                self.fresh = (self.fresh + 1) & 0xFF
+                segments.append(segment)
+        return segments
@@ -86,21 +86,21 @@ class uint64:
 
 class int8:
     def __new__(cls, value: int):
-        return pack("<b", int(value) & 0xFF)
+        return pack("<B", int(value) & 0xFF)
 
     decode = IntegerDecoder(1, signed=True)
 
 
 class int16:
     def __new__(cls, value: int):
-        return pack("<h", int(value) & 0xFFFF)
+        return pack("<H", int(value) & 0xFFFF)
 
     decode = IntegerDecoder(2, signed=True)
 
 
 class int32:
     def __new__(cls, value: int):
-        return pack("<i", int(value) & 0xFFFFFFFF)
+        return pack("<I", int(value) & 0xFFFFFFFF)
 
     decode = IntegerDecoder(4, signed=True)
 
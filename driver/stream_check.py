@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# Check that Driver.stream_moves keeps the shared command queue near full.
+# Runs against the native firmware build (or a board), exits with failure if
+# the queue depth never came within one frame of its capacity or a motor did
+# not end up where the moves put it:
+#   TSC_SERIAL=/tmp/tsc pio run -e native -t exec &
+#   TSC_SERIAL=/tmp/tsc driver/stream_check.py
+import argparse
+from time import sleep
+from sys import path, stderr, exit
+from posixpath import dirname
+
+path.append(dirname(__file__))
+
+from lib.driver import Driver
+from lib.protocol import Method, Prop, Transport, pack_moves, packed_count
+
+parser = argparse.ArgumentParser(description="Move streaming check")
+parser.add_argument(
+    "-B", "--baud", type=int, default=115200, help="Baud rate for serial communication"
+)
+parser.add_argument(
+    "-n", "--moves", type=int, default=3000, help="Number of moves to stream"
+)
+parser.add_argument("--stcp", action="store_true", help="Stream over STCP")
+args = parser.parse_args()
+
+driver = Driver(baudrate=args.baud)
+print(f"Device Info: {driver.getInfo()}", file=stderr)
+
+# One motor, 1 ms per move, so that the device drains slower than the host
+# fills the queue
+moves = [(0, 10 if i % 2 else -9, 100) for i in range(args.moves)]
+# Lowest credit reported while streaming, the queue is that far from full
+credits = Driver.credits
+lowest = [None]
+
+
+def observe(packet):
+    free = credits(packet)
+    if free is not None and (lowest[0] is None or free < lowest[0]):
+        lowest[0] = free
+    return free
+
+
+driver.credits = observe
+ok = True
+with driver.enable():
+    if args.stcp:
+        driver.transport(Transport.STCP)
+    driver(Method.SET, Prop.MOT_ENA, bytes([0, 1]), expect=(Method.ACK, Prop.MOT_ENA))
+    start = driver.positions()[1][0][0]
+    capacity = driver.queue_status(0)["capacity"]
+    frame = max(packed_count(p) for p in pack_moves(moves, driver.payload_limit))
+    driver.stream_moves(moves)
+    depth = capacity - lowest[0]
+    print(f"Queue depth reached {depth} of {capacity} (frames of up to {frame})")
+    if depth < capacity - frame:
+        print("FAIL: queue was not kept near full", file=stderr)
+        ok = False
+    sleep(0.1)
+    position = driver.positions()[1][0][0] - start
+    expected = sum(steps for _, steps, _ in moves)
+    if position != expected:
+        print(f"FAIL: motor moved {position} steps, expected {expected}", file=stderr)
+        ok = False
+driver.close()
+print("PASS" if ok else "FAIL")
+exit(0 if ok else 1)
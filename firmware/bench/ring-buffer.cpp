@@ -0,0 +1,224 @@
+// =============================================================================
+// Stress test and throughput benchmark of the lock-free queues (RingBuffer,
+// Arena) with the producer and the consumer on two host threads, the way the
+// agent and the step ISR use them from two cores. Exits with failure if any
+// item is lost, duplicated or out of order. Either side yields when it cannot
+// make progress, so it also completes (slowly) on a single core host.
+//   pio run -e bench-ring-buffer -t exec
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include <Arduino.h>
+#include <arena.h>
+#include <chrono>
+#include <cstdlib>
+#include <ring-buffer.h>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t STRESS_ITEMS = 20000000;
+static constexpr uint32_t BENCH_ITEMS = 50000000;
+static constexpr size_t BATCH = 64;
+
+size_t debug_write(void *buf, size_t size) {
+  return fwrite(buf, 1, size, stderr);
+}
+
+// Cheap per-thread generator for batch sizes and access patterns
+static inline uint32_t xorshift(uint32_t &state) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static RingBuffer<uint32_t, 1024> ring;
+
+// Items are consecutive numbers, every access pattern is mixed at random on
+// both sides so that spans and single items meet at every offset
+static bool stressRing() {
+  uint32_t errors = 0, overfull = 0;
+  std::thread producer([&] {
+    uint32_t state = 1, next = 0, batch[BATCH];
+    while (next < STRESS_ITEMS) {
+      const uint32_t mode = xorshift(state) % 3;
+      const uint32_t want = 1 + xorshift(state) % BATCH;
+      const uint32_t before = next;
+      if (mode == 0) {
+        if (ring.writable())
+          ring.push(next++);
+      } else if (mode == 1) {
+        uint32_t n = 0;
+        while (n < want && next + n < STRESS_ITEMS) {
+          batch[n] = next + n;
+          n++;
+        }
+        next += ring.write(batch, n);
+      } else {
+        const auto span = ring.push_span();
+        uint32_t n = 0;
+        while (n < span.size && n < want && next < STRESS_ITEMS)
+          span.data[n++] = next++;
+        ring.commit(n);
+      }
+      if (ring.len() > ring.capacity())
+        overfull++;
+      if (next == before)
+        std::this_thread::yield();
+    }
+  });
+  uint32_t state = 2, expected = 0, batch[BATCH];
+  while (expected < STRESS_ITEMS) {
+    const uint32_t mode = xorshift(state) % 3;
+    const uint32_t want = 1 + xorshift(state) % BATCH;
+    const uint32_t before = expected;
+    if (mode == 0) {
+      if (ring.readable()) {
+        errors += ring.peek() != expected++;
+        ring.pop();
+      }
+    } else if (mode == 1) {
+      const size_t n = ring.read(batch, want);
+      for (size_t i = 0; i < n; i++)
+        errors += batch[i] != expected++;
+    } else {
+      const auto span = ring.peek_span();
+      const size_t n = span.size < want ? span.size : want;
+      for (size_t i = 0; i < n; i++)
+        errors += span.data[i] != expected++;
+      ring.pop(n);
+    }
+    if (ring.len() > ring.capacity())
+      overfull++;
+    if (expected == before)
+      std::this_thread::yield();
+  }
+  producer.join();
+  printf("RingBuffer: %u items, %u out of sequence, %u overfull, %s\n",
+         STRESS_ITEMS, errors, overfull, ring.readable() ? "left over" : "drained");
+  return errors == 0 && overfull == 0 && !ring.readable();
+}
+
+// Three queues on one pool, like the motor command queues. The producer
+// fills them unevenly (one busy queue), the consumer drains round robin.
+static constexpr unsigned QUEUES = 3;
+typedef Arena<uint32_t, 768> Pool;
+static Pool pool;
+static Pool::Queue queues[QUEUES] = {{pool}, {pool}, {pool}};
+
+static bool stressArena() {
+  std::atomic<bool> done{false};
+  uint32_t errors = 0;
+  std::thread consumer([&] {
+    uint32_t expected[QUEUES] = {0};
+    while (!done.load(std::memory_order_acquire) ||
+           queues[0].readable() || queues[1].readable() ||
+           queues[2].readable()) {
+      bool idle = true;
+      for (unsigned q = 0; q < QUEUES; q++) {
+        if (!queues[q].readable())
+          continue;
+        errors += queues[q].peek() != expected[q]++;
+        queues[q].pop();
+        idle = false;
+      }
+      if (idle)
+        std::this_thread::yield();
+    }
+  });
+  uint32_t state = 3, next[QUEUES] = {0}, released[QUEUES] = {0};
+  uint32_t pushed = 0, misreleased = 0;
+  while (pushed < STRESS_ITEMS) {
+    // Queue 0 gets most of the traffic
+    const uint32_t r = xorshift(state) % 8;
+    const unsigned q = r < 6 ? 0 : r - 5;
+    if (queues[q].writable()) {
+      queues[q].push(next[q]++);
+      pushed++;
+    } else {
+      std::this_thread::yield();
+    }
+    for (unsigned i = 0; i < QUEUES; i++) {
+      while (const auto item = queues[i].completed()) {
+        misreleased += *item != released[i]++;
+        queues[i].release();
+      }
+    }
+  }
+  done.store(true, std::memory_order_release);
+  consumer.join();
+  for (unsigned i = 0; i < QUEUES; i++) {
+    while (const auto item = queues[i].completed()) {
+      misreleased += *item != released[i]++;
+      queues[i].release();
+    }
+  }
+  const bool recycled = pool.space() == pool.capacity();
+  printf("Arena: %u items (%u / %u / %u), %u out of sequence, %u misreleased, "
+         "%s\n",
+         pushed, next[0], next[1], next[2], errors, misreleased,
+         recycled ? "all slots recycled" : "slots leaked");
+  return errors == 0 && misreleased == 0 && recycled;
+}
+
+// Items per second through the ring, one at a time or BATCH at a time
+static double throughput(bool bulk) {
+  const auto t0 = Clock::now();
+  std::thread producer([&] {
+    uint32_t next = 0, batch[BATCH];
+    while (next < BENCH_ITEMS) {
+      size_t n = 0;
+      if (!bulk) {
+        if (ring.writable()) {
+          ring.push(next);
+          n = 1;
+        }
+      } else {
+        for (size_t i = 0; i < BATCH; i++)
+          batch[i] = next + i;
+        n = ring.write(batch, BATCH);
+      }
+      next += n;
+      if (!n)
+        std::this_thread::yield();
+    }
+  });
+  uint32_t received = 0, batch[BATCH];
+  volatile uint32_t sink = 0;
+  while (received < BENCH_ITEMS) {
+    size_t n = 0;
+    if (!bulk) {
+      if (ring.readable()) {
+        sink = sink + ring.peek();
+        ring.pop();
+        n = 1;
+      }
+    } else {
+      n = ring.read(batch, BATCH);
+      for (size_t i = 0; i < n; i++)
+        sink = sink + batch[i];
+    }
+    received += n;
+    if (!n)
+      std::this_thread::yield();
+  }
+  producer.join();
+  const std::chrono::duration<double> dt = Clock::now() - t0;
+  return BENCH_ITEMS / dt.count();
+}
+
+void setup() {
+  printf("Two thread stress test, %u items each\n", STRESS_ITEMS);
+  const bool ok = stressRing() && stressArena();
+  printf("\nRingBuffer<uint32_t, %u> throughput, %u items\n",
+         ring.capacity(), BENCH_ITEMS);
+  printf("%12s %14s\n", "batch", "[M items/s]");
+  printf("%12u %14.1f\n", 1u, throughput(false) / 1e6);
+  printf("%12u %14.1f\n", static_cast<unsigned>(BATCH), throughput(true) / 1e6);
+  printf("\n%s\n", ok ? "PASS" : "FAIL");
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void loop() {}
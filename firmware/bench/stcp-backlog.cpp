@@ -0,0 +1,171 @@
+// =============================================================================
+// Test of the STCP backlog push back: the host stops acknowledging (its
+// window stays closed) while the device keeps replying. TX must report that
+// it is not ready before the backlog runs out, drop nothing but unsolicited
+// frames, keep taking in the segments that carry ACKs while requests are held
+// back, and deliver every reply once the host acknowledges again. Exits with
+// failure on the first violation.
+//   pio run -e bench-stcp-backlog -t exec
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include <Arduino.h>
+#include <cstdlib>
+#include <protocol.h>
+#include <vector>
+
+using namespace Protocol;
+
+size_t debug_write(void *buf, size_t size) {
+  return fwrite(buf, 1, size, stderr);
+}
+
+// Time stands still, nothing is retransmitted behind the test's back
+static uint32_t clock_ms() { return 0; }
+
+// Device to host and host to device byte streams
+static std::vector<uint8_t> upstream, downstream;
+static size_t downstream_read = 0;
+
+static size_t device_write(const void *buf, size_t size) {
+  const auto bytes = static_cast<const uint8_t *>(buf);
+  upstream.insert(upstream.end(), bytes, bytes + size);
+  return size;
+}
+
+static size_t device_read(void *buf, size_t size) {
+  const size_t left = downstream.size() - downstream_read;
+  if (size > left)
+    size = left;
+  memcpy(buf, downstream.data() + downstream_read, size);
+  downstream_read += size;
+  return size;
+}
+
+static STCP::Port device(clock_ms), host(clock_ms);
+static TX tx(device_write);
+static RX rx(device_read);
+
+static bool ok = true;
+
+#define CHECK(COND, ...)                                                       \
+  do {                                                                         \
+    if (!(COND)) {                                                             \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__);                              \
+      printf(__VA_ARGS__);                                                     \
+      printf("\n");                                                            \
+      ok = false;                                                              \
+    }                                                                          \
+  } while (0)
+
+// Segments written by the device since the last call, decoded
+static std::vector<std::vector<uint8_t>> segments() {
+  std::vector<std::vector<uint8_t>> out;
+  COBS::RX cobs;
+  uint8_t segment[STCP::MAX_SEGMENT];
+  const uint8_t *head = upstream.data(), *end = head + upstream.size();
+  while (head != end) {
+    const auto ret = cobs.decode(head, end, segment);
+    if (ret == COBS::UNFINISHED)
+      break;
+    cobs.reset();
+    if (ret > 0)
+      out.emplace_back(segment, segment + ret);
+  }
+  upstream.clear();
+  return out;
+}
+
+// Host side segments (ACKs, requests) to the device
+static void transmit_host() {
+  uint8_t segment[STCP::MAX_SEGMENT];
+  while (const uint8_t len = host.next(segment)) {
+    COBS::TX cobs;
+    cobs.encode(segment, len);
+    downstream.insert(downstream.end(), cobs.payload(),
+                      cobs.payload() + cobs.size());
+  }
+}
+
+// A reply numbered by its sequence, as the agent would send it
+static void reply(Sequence s) { tx.send(s, Method::ACK, Property::FW_INFO); }
+
+void setup() {
+  tx.transport = rx.transport = &device;
+  // Device replies while the host withholds every ACK
+  Sequence replied = 0;
+  while (tx.ready())
+    reply(++replied);
+  tx.flush();
+  CHECK(replied == STCP::BACKLOG - TX::RESERVE + 1,
+        "ready() turned false after %u replies", replied);
+  // A request already taken in still gets all of its replies
+  for (unsigned i = 1; i < TX::RESERVE; i++)
+    reply(++replied);
+  // Unsolicited frames never take the reserve, replies never get dropped
+  const unsigned before = tx.dropped;
+  tx.send(0, Method::SYN, Property::MOT_STAT);
+  CHECK(tx.dropped == before + 1, "SYN frame was not dropped");
+  CHECK(tx.dropped == 1, "%u frames dropped", tx.dropped);
+  CHECK(device.space() == 0, "backlog has %u entries left", device.space());
+  tx.flush();
+  auto upstream_segments = segments();
+  CHECK(upstream_segments.size() == STCP::WINDOW,
+        "%zu segments sent into a closed window", upstream_segments.size());
+
+  // The host sends a request meanwhile, it is held back but the segments are
+  // still taken in
+  uint8_t request[8];
+  Frame frame;
+  frame.header.set(1000, Method::GET, Property::FW_INFO);
+  frame.payload_size = 0;
+  const uint8_t len = frame.seal(XOR);
+  memcpy(request, frame.buffer, len);
+  host.send(request, len);
+  transmit_host();
+  CHECK(!rx.recv(tx.ready()), "request delivered while TX is not ready");
+
+  // Host takes in the window and acknowledges it, the ACK frees the backlog
+  // even though requests are still held back
+  std::vector<std::vector<uint8_t>> bodies;
+  uint8_t body[STCP::MAX_PAYLOAD];
+  const auto receive = [&](std::vector<std::vector<uint8_t>> &from) {
+    for (auto &s : from)
+      CHECK(host.input(s.data(), s.size()), "bad segment");
+    int n;
+    while ((n = host.deliver(body)) >= 0)
+      bodies.emplace_back(body, body + n);
+    transmit_host();
+  };
+  receive(upstream_segments);
+  CHECK(!rx.recv(false), "frame delivered while held back");
+  CHECK(device.space() == STCP::WINDOW, "ACK freed %u entries",
+        device.space());
+
+  // Drain: every reply arrives in order, exactly once
+  for (unsigned round = 0; round < 64 && bodies.size() < replied; round++) {
+    rx.recv(false);
+    tx.flush();
+    auto next = segments();
+    receive(next);
+  }
+  CHECK(bodies.size() == replied, "%zu of %u replies delivered",
+        bodies.size(), replied);
+  for (size_t i = 0; i < bodies.size(); i++) {
+    Header header;
+    memcpy(&header, bodies[i].data(), sizeof(header));
+    CHECK(header.sequence == i + 1, "reply %zu has sequence %u", i,
+          header.sequence);
+  }
+  CHECK(tx.ready(), "not ready after the backlog drained");
+
+  // The held back request comes through now
+  CHECK(rx.recv(tx.ready()), "request not delivered once TX is ready");
+  CHECK(rx.frame.header.sequence == 1000, "wrong request delivered");
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void loop() {}
@@ -8,6 +8,7 @@
 #pragma once
 #include <Arduino.h>
 #include <pins_arduino.h>
+#include <soc/gpio_struct.h>
 
 namespace Board {
 
@@ -15,11 +16,14 @@ class Pin {
   inline int maybeInverted(int value) const { return invert ? !value : value; }
 
 public:
-  const uint8_t pin;  // GPIO pin number
-  const uint8_t mode; // GPIO pin mode
+  const uint8_t pin;   // GPIO pin number
+  const uint8_t mode;  // GPIO pin mode
   const bool invert;
+  const uint8_t bank;  // GPIO register bank, 0 for GPIO 0-31, 1 for GPIO 32+
+  const uint32_t mask; // Bit of this pin in its register bank
   Pin(uint8_t pin, uint8_t mode, bool invert = false)
-      : pin(pin), mode(mode), invert(invert) {};
+      : pin(pin), mode(mode), invert(invert), bank(pin >> 5),
+        mask(1UL << (pin & 31)) {};
   inline void init() const { pinMode(pin, mode); }
   inline bool read() const { return maybeInverted(digitalRead(pin)); }
   inline void write(bool value) const {
@@ -27,11 +31,29 @@ public:
       digitalWrite(pin, maybeInverted(value));
     }
   }
-  inline void toggle() const {
-    if (mode == OUTPUT || mode == OUTPUT_OPEN_DRAIN) {
-      digitalWrite(pin, !digitalRead(pin));
+  // Fast path, writes the GPIO set/clear registers directly (output only)
+  inline void set(bool value) const {
+    if (maybeInverted(value)) {
+      if (bank)
+        GPIO.out1_w1ts.val = mask;
+      else
+        GPIO.out_w1ts = mask;
+    } else {
+      if (bank)
+        GPIO.out1_w1tc.val = mask;
+      else
+        GPIO.out_w1tc = mask;
     }
   }
+  // Fast path, reads the GPIO input register directly
+  inline bool level() const {
+    return maybeInverted((bank ? GPIO.in1.val : GPIO.in) & mask);
+  }
+  // Level currently driven by the output register
+  inline bool driven() const {
+    return maybeInverted((bank ? GPIO.out1.val : GPIO.out) & mask);
+  }
+  inline void toggle() const { set(!driven()); }
   inline void analogWrite(int value) const {
     if (invert)
       value = 255 - value;
@@ -41,6 +63,27 @@ public:
   }
 };
 
+// Output changes collected across pins and applied with one set and one clear
+// register write per bank, so that they take effect simultaneously.
+class Batch {
+  uint32_t high[2] = {0, 0}, low[2] = {0, 0};
+
+public:
+  inline void add(const Pin &pin, bool value) {
+    (pin.invert != value ? high : low)[pin.bank] |= pin.mask;
+  }
+  inline void flush() {
+    if (high[0])
+      GPIO.out_w1ts = high[0];
+    if (low[0])
+      GPIO.out_w1tc = low[0];
+    if (high[1])
+      GPIO.out1_w1ts.val = high[1];
+    if (low[1])
+      GPIO.out1_w1tc.val = low[1];
+  }
+};
+
 namespace Port {
 extern struct SPI {
   Pin MISO, MOSI, CS, SCLK;
@@ -78,19 +121,17 @@ extern Pin BUILTIN, RED, GREEN, BLUE; // Onboard RGB LED
 // External Switches
 class Switch : public Pin {
 public:
-  typedef struct Subscription {
-    bool rise : 1;
-    bool fall : 1;
-    bool change : 1;
-    void clear() { rise = fall = change = false; }
-  } Subscription;
-
-  // Only one process can subscribe at a time.
-  Subscription *sub = nullptr;
+  // Called in interrupt context on every level change, with the new level.
+  // Only one handler can be installed at a time.
+  void (*volatile handler)(const Switch &sw, bool level) = nullptr;
 
   void (*const trigger_helper)();
 
-  inline void trigger() {};
+  inline void trigger() {
+    const auto h = handler;
+    if (h)
+      h(*this, level());
+  };
 
   Switch(Pin &&pin, void (*trigger_helper)())
       : Pin(pin), trigger_helper(trigger_helper) {};
@@ -0,0 +1,25 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+
+#include "protocol-impl.h"
+
+// Limit switches on Board::SW, handled in interrupt context. While a mapped
+// switch is active, the ISR suppresses steps of its motor in the blocked
+// directions and halts the motor, whose queue the agent then rejects (see
+// Motor::Motor::recover()). Switch changes are reported as SYN SYS_CFG
+// events (Protocol::EndstopEvent).
+namespace Endstop {
+
+// Installs the switch interrupt handlers, all switches start unmapped
+void init();
+// Returns false if the switch or motor does not exist
+bool configure(const Protocol::ConfigEndstop &cfg);
+// Current mapping of a switch, nullptr if there is no such switch
+const Protocol::ConfigEndstop *config(uint8_t index);
+// Sends pending switch events, agent only
+void poll();
+
+} // namespace Endstop
@@ -12,6 +12,8 @@ extern unsigned rx_count, tx_count;
 
 extern Protocol::RX rx;
 extern Protocol::TX tx;
+// Attached to rx and tx once the host switches to STCP
+extern STCP::Port stcp;
 
 namespace Config {
 
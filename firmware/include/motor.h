@@ -6,94 +6,310 @@
 
 #include <cstdint>
 
-#include <TMCStepper.h>
-
 #include "board.h"
 #include "duration_literals.h"
 #include "global.h"
 #include "protocol-header.h"
+#include "arena.h"
 #include "protocol-impl.h"
-#include "ring-buffer.h"
+#include "stats.h"
+#include "tmc.h"
 
-void motorTick();
+// Processes all motors due at the given time (timer microseconds), returns
+// the next deadline or Motor::Scheduler::IDLE if all motors are idle.
+Micros motorTick(Micros now);
 
 namespace Motor {
 using Sequence = Protocol::Sequence;
 
+// Event driven step scheduler. The hardware timer alarm is programmed for
+// the earliest deadline among all motors, and disabled when all of them are
+// idle. Producers must call wake() after pushing new commands.
+namespace Scheduler {
+constexpr Micros IDLE = ~0ULL;
+// Minimum lead time when programming the alarm, avoids arming in the past
+constexpr Micros LEAD = 2_us;
+// Takes over the timer (counting in microseconds), call on the ISR core
+void begin(hw_timer_t *timer);
+Micros now();
+void wake();
+// Wait for a tick in progress (on the other core) to finish. Flags the ISR
+// checks (e.g. Motor::lock) set before are seen by every later tick.
+void sync();
+// Snapshot (and optionally reset) a timing histogram, consistent with the
+// ISR. Returns false if there is no such statistic.
+bool stat(const Protocol::StatHeader &which, Protocol::Histogram &out,
+          bool reset);
+// Motors (bit mask of MotorID) whose queued barriers were dropped, e.g. by an
+// endstop. They are not waited for until they take part in a new barrier.
+extern volatile uint8_t detached;
+// Snapshot of all motor positions, consistent with the ISR
+void positions(Protocol::MotorPosition &out);
+} // namespace Scheduler
+
+typedef enum : uint8_t {
+  MOVE = 0,    // Constant step interval
+  RAMP = 1,    // Step interval integrated from an acceleration profile
+  SEGMENT = 2, // Steps spread evenly over a fixed duration
+  BARRIER = 3, // Hold until all participating motors arrive
+  HOME = 4,    // Constant step interval toward a stall
+  BACKOFF = 5, // ISR only, backing off the stall after HOME
+} Kind;
+
+// Why the ISR stopped a motor, the agent rejects its queue with the reason
+typedef enum : uint8_t {
+  RUNNING = 0,
+  ENDSTOP = Protocol::HALT_ENDSTOP,
+  STALL = Protocol::HALT_STALL,
+  HOMING_FAILED = Protocol::HALT_HOMING_FAILED,
+  STOPPED = Protocol::HALT_STOPPED, // Requested by the agent (stop())
+} Halt;
+
+// Steps (in full steps) after starting from rest or reversing, during which
+// StallGuard reports are ignored. It is unreliable until the motor is up to
+// speed.
+constexpr uint32_t STALL_BLANKING = 8;
+
+// Step timing in fixed point, FRACTION bits below the microsecond. Edges
+// still land on the microsecond timer, but the time of each step is kept
+// exactly (phase accumulator), so intervals that are not whole microseconds
+// carry their remainder to the next step instead of losing it.
+constexpr unsigned FRACTION = 8;
+typedef uint64_t Fixed;
+constexpr Fixed fixed(Micros us) { return us << FRACTION; }
+// First timer tick at or after a fixed point time
+constexpr Micros ceilMicros(Fixed t) {
+  return (t + (1 << FRACTION) - 1) >> FRACTION;
+}
+
+// Commands with sequence 0 are not acknowledged
 typedef struct Command {
   Sequence seq;
+  Kind kind;
   Steps steps;
-  Interval interval;
+  union {
+    struct {
+      Interval interval; // MOVE
+      uint16_t batch;    // MOVE, handle of the frame's Batch, 0 if none
+    };
+    Protocol::MotorRamp::Profile ramp; // RAMP
+    Interval duration;                  // SEGMENT
+    uint8_t participants;               // BARRIER, bit mask of MotorID
+    struct {
+      Interval interval;
+      Steps backoff;
+    } home; // HOME
+  };
 } Command;
 
+// Command slots shared by the queues of all motors. Sized to the memory of
+// the former fixed per-motor rings (256 commands and 512 sequences each), so
+// a single busy motor gets three times the lookahead.
+constexpr size_t POOL = 768;
+typedef Arena<Command, POOL> CommandArena;
+extern CommandArena arena;
+// Commands that can be queued in total, each queue holds one slot
+constexpr unsigned CAPACITY = POOL - 3;
+
+// A MOT_MOV frame with moves for several motors is acknowledged once, when
+// the last motor involved picks up its part (see Protocol::MotorRange). The
+// last move of each motor carries the sequence and the handle of a batch,
+// which keeps track of the motors still to come. Agent only.
+namespace Batch {
+// Open a batch for the given motors (bit mask of MotorID), returns its
+// handle, 0 if none is free
+uint16_t open(uint8_t motors);
+// Motor `addr` is done with its part, either picked up or rejected. Returns
+// true if this part settles the frame, i.e. its ACK or REJ is due with this
+// motor: the last part picked up of a frame not rejected yet, or the first
+// part rejected.
+bool settle(uint16_t handle, uint8_t addr, bool rejected);
+} // namespace Batch
+
+// Distributes a duration over a number of steps (Bresenham), so that step
+// intervals differ by at most 1us and add up to exactly the duration.
+class Bresenham {
+  Interval base;
+  uint32_t remainder, count, error;
+
+public:
+  // Returns the first step interval, or the full duration if steps == 0
+  inline Interval load(Steps steps, Interval duration) {
+    count = steps < 0 ? -steps : steps;
+    if (count == 0)
+      return duration;
+    base = duration / count;
+    remainder = duration % count;
+    error = 0;
+    return next();
+  }
+  inline Interval next() {
+    error += remainder;
+    if (error < count)
+      return base;
+    error -= count;
+    return base + 1;
+  }
+};
+
+// Acceleration ramp integrated by the ISR, one update per step.
+// Integer only (no FPU in ISR context) and free of 64-bit divides, which
+// Xtensa runs in software. Rates are kept in steps/s with a SCALE bit
+// fraction so that a constant acceleration integrates without visible
+// rounding error.
+class Ramp {
+  static constexpr unsigned SCALE = 24;
+  uint64_t rate, target; // steps/s << SCALE
+  uint64_t accel, limit; // steps/s^2 << SCALE
+  uint32_t jerk;         // steps/s^3
+
+public:
+  // Clamp start/end rates so that the first and last step intervals stay
+  // finite, i.e. no slower than one step under the given accel/jerk.
+  static Protocol::MotorRamp::Profile
+  sanitize(const Protocol::MotorRamp::Profile &profile);
+  // Load a new profile, returns the first step interval
+  Fixed load(const Protocol::MotorRamp::Profile &profile);
+  // Advance the ramp by dt (the interval just elapsed), returns next interval
+  Fixed next(Fixed dt);
+  Fixed interval() const;
+};
+
 class Motor {
 public:
   const Board::Pin &step, &dir, &diag;
   const uint8_t addr;
-  TMC2209Stepper driver;
+  // Registers are written in the background by TMC::poll()
+  TMC::Driver &driver;
 
   inline Motor(Board::Drv &drv, uint8_t addr)
-      : driver(TMC2209Stepper(reinterpret_cast<Stream *>(&Board::Drv::serial),
-                              0.11f, addr)),
-        step(drv.step), dir(drv.dir), diag(drv.diag), addr(addr) {}
+      : step(drv.step), dir(drv.dir), diag(drv.diag), addr(addr),
+        driver(TMC::drivers[addr]), pending(arena) {}
 
   // Flag indicating whether the motor is enabled
   // ISR handler skips disabled motors
   volatile bool enabled = false;
-  // Temporarily make ISR skip this motor to avoid race conditions
+  // Temporarily make ISR skip this motor to avoid race conditions, takes
+  // effect once Scheduler::sync() returns
   volatile bool lock = false;
 
-  inline bool isAvailableForISR() { return enabled && !lock; }
-  // ISR maintained state
-  Micros last_step;
+  // Set by the ISR when it stopped the motor, the ISR skips it until the
+  // agent has rejected its pending commands (see recover())
+  volatile Halt halted = RUNNING;
+  // Directions (Protocol::Direction mask) blocked by active endstops
+  volatile uint8_t blocked = 0;
+  // Set by the DIAG interrupt, consumed by the ISR on the next step
+  volatile bool stalled = false;
+  // Halt on stalls during regular moves (HOME always watches for stalls)
+  volatile bool stall_abort = false;
+  // Set by stop(), consumed by the ISR on its next tick
+  volatile bool stopping = false;
+
+  inline bool isAvailableForISR() {
+    return enabled && !lock && halted == RUNNING;
+  }
+  // ISR maintained state, step times and intervals in fixed point
+  Fixed last_step;
+  Kind kind;
   Steps steps;
-  Interval interval;
+  Fixed interval;
+  Ramp ramp;
+  Bresenham bresenham;
+  // Shadowed output levels, so that the ISR never reads back GPIO state
+  bool step_level, forward;
+  // Set when the motor is holding at a barrier
+  volatile bool waiting = false;
+  // Absolute position, one count per step edge
+  volatile Steps position = 0;
+  // Steps since starting from rest or reversing, stalls are ignored until
+  // it reaches the blanking length (STALL_BLANKING in micro steps)
+  uint32_t run = 0, blanking = 0;
+  // HOME command in progress, acknowledged once the position is zeroed
+  Steps backoff = 0;
+  volatile Sequence homing = 0;
+  // Step edge lateness against the schedule (us)
+  Stats::Histogram lateness;
 
-  // Pending move commands [Producer: main thread | Consumer: ISR]
-  RingBuffer<Command, 256> pending;
-  // Completed move commands [Producer: ISR | Consumer: main thread]
-  RingBuffer<Sequence, 512> done;
+  // Pending move commands [Producer: main thread | Consumer: ISR], commands
+  // picked up by the ISR are acknowledged from here as well (completed())
+  CommandArena::Queue pending;
 
-  inline bool online() { return driver.test_connection() == 0; }
+  // Queue watermarks, SYN MOT_QUE is sent when crossed (disabled by default)
+  Protocol::MotorQueue::Watermark watermark = {0, CAPACITY};
+  enum : uint8_t { BELOW_LOW, NORMAL, ABOVE_HIGH } level = NORMAL;
+  Protocol::MotorQueue queueStatus() const;
+  // ACK / REJ range of `count` commands, with the current queue levels
+  Protocol::MotorRange rangeReport(uint16_t count) const;
+  // Send SYN MOT_QUE if the queue level crossed a watermark
+  void checkWatermark();
+
+  // Report commands picked up by the ISR in cumulative ACK frames. Stops once
+  // TX runs short of room (the rest is reported on a later call) unless `all`
+  // is set.
+  void acknowledge(bool all = false);
+  // Drop all pending commands (and the HOME in progress), reported in one
+  // cumulative REJ frame
+  void flush(Protocol::HaltReason reason);
+  // Reject the queue of a motor halted by the ISR and let it resume. Returns true if the motor was halted.
+  bool recover();
+  // Halt the motor where it is (also at a barrier), its queue is rejected by
+  // recover() once the ISR complied
+  inline void stop() {
+    stopping = true;
+    Scheduler::wake();
+  }
+
+  // Last known state of the UART link, never blocks
+  inline bool online() { return driver.online(); }
+  // Request a background readout of the driver health registers
+  void probe();
+  // True once the readout requested by probe() completed
+  bool probed() const;
+  // Bring the driver registers in line with the config and enable state,
+  // only registers that changed are written
   void updateConfig(const Protocol::MotorConfig::Config *cfg = nullptr);
 
+  // Driver output stage on (CHOPCONF.TOFF != 0)
+  bool energized = false;
+
   Protocol::MotorConfig::Config config = {
       .micro_steps = 32,
       .stall_sensitivity = 40,
       .rms_current = 1000,
   };
 
-  inline void init() {
+  inline void init(void (*diag_helper)()) {
     dir.init();
     step.init();
     diag.init();
-    driver.begin();
+    // StallGuard pulses DIAG on a stall
+    attachInterrupt(diag.pin, diag_helper, RISING);
     this->disable();
   }
   inline void enable() {
     if (enabled)
       return;
+    energized = true;
     updateConfig();
-    driver.toff(5);
-    last_step = micros();
+    step_level = step.driven();
+    forward = dir.driven();
+    last_step = fixed(Scheduler::now());
     enabled = true;
   }
   inline void disable() {
     enabled = false;
-    driver.toff(0);
+    energized = false;
+    updateConfig();
     // Resolve all completed commands
-    while (done.readable()) {
-      Global::tx.send(done.peek(), Protocol::Method::ACK,
-                      Protocol::Property::MOT_MOV);
-      done.pop();
-    }
+    acknowledge();
     // Reject all pending commands
-    while (pending.readable()) {
-      Global::tx.print(pending.peek().seq, Protocol::Method::REJ,
-                       Protocol::Property::MOT_MOV, "Motor Disabled");
-      pending.pop();
-    }
+    flush(Protocol::HALT_DISABLED);
+    halted = RUNNING;
+    stopping = false;
     // Reset ISR maintained state
+    kind = MOVE;
+    stalled = false;
+    waiting = false;
     steps = 0;
     interval = 0;
   }
@@ -103,6 +319,22 @@ public:
 
 extern Motor::Motor motors[3];
 
+namespace Motor {
+// Latest driver health readings of all motors
+void health(Protocol::DriverStatus &out);
+// Queue a barrier on all participants (bit mask of MotorID), followed by the
+// segment if given. Only the first participant carries the sequence, the
+// caller makes sure there is space.
+void barrier(uint8_t participants, const Protocol::Segment *segment,
+             Sequence seq);
+// Shortest step interval a segment may ask for, keeps a step from falling
+// due before the alarm can be armed for it
+constexpr Micros MIN_INTERVAL = 2 * Scheduler::LEAD;
+// Whether every axis of the segment fits its duration, at no less than
+// MIN_INTERVAL per step
+bool feasible(const Protocol::Segment &segment);
+} // namespace Motor
+
 inline Motor::Motor *getMotorByID(MotorID id) {
   for (auto &motor : motors) {
     if (motor.addr == id)
@@ -113,11 +345,6 @@ inline Motor::Motor *getMotorByID(MotorID id) {
 
 namespace Motor {
 
-inline void init() {
-  Board::Drv::init();
-  Board::Drv::enable();
-  for (auto &motor : motors)
-    motor.init();
-}
+void init();
 
 } // namespace Motor
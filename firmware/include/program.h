@@ -0,0 +1,39 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+
+#include "protocol-impl.h"
+
+// Motion program stored on the device (MOT_PROG). The agent expands the
+// program into the step queues as far as they have room, resolving jumps and
+// loops on the way, and the ISR plays the motion back exactly as if the host
+// had queued it. Stored programs are streamed from flash the same way. A
+// program ends on HALT (or past its last instruction), on stop(), or when a
+// motor it drives is halted or disabled. The end is reported as a SYN
+// MOT_PROG event (Protocol::ProgramEvent).
+namespace Program {
+
+constexpr uint16_t CAPACITY = 256;
+
+// Write instructions at an offset (0 or the current size), returns an error
+// message or nullptr
+const char *load(uint16_t offset, const Protocol::Instruction *code,
+                 unsigned count);
+// Start from an entry point, returns an error message or nullptr
+const char *run(uint16_t entry);
+// Same as load() / run(), on a program in storage (see Store)
+const char *store(uint8_t slot, uint16_t offset,
+                  const Protocol::Instruction *code, unsigned count);
+const char *play(uint8_t slot, uint16_t entry);
+const char *erase(uint8_t slot);
+// End the program and halt the motion it still has queued
+void stop(Protocol::ProgramEnd reason);
+// A motor was halted by the ISR (see Motor::Motor::recover())
+void interrupted(uint8_t addr);
+Protocol::ProgramStatus status();
+// Queue more motion, agent only
+void poll();
+
+} // namespace Program
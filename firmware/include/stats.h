@@ -0,0 +1,51 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "protocol-impl.h"
+
+namespace Stats {
+
+// Running min / max / sum and log2 bucketed histogram of a sample stream.
+// Cheap enough to be updated by the ISR on every tick, readers must hold the
+// scheduler lock (see Motor::Scheduler::stat).
+class Histogram {
+public:
+  static constexpr unsigned BUCKETS = 16;
+
+private:
+  uint32_t count = 0, min = UINT32_MAX, max = 0;
+  uint64_t sum = 0;
+  uint32_t buckets[BUCKETS] = {};
+
+public:
+  inline void add(uint32_t value) {
+    count++;
+    sum += value;
+    if (value < min)
+      min = value;
+    if (value > max)
+      max = value;
+    const unsigned bucket = value ? 32 - __builtin_clz(value) : 0;
+    buckets[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+  }
+
+  inline void reset() { *this = Histogram(); }
+
+  inline void read(Protocol::Histogram &packet) const {
+    packet.count = count;
+    packet.min = count ? min : 0;
+    packet.max = max;
+    packet.sum = sum;
+    static_assert(sizeof(packet.buckets) == sizeof(buckets),
+                  "Histogram packet must carry all buckets");
+    memcpy(packet.buckets, buckets, sizeof(buckets));
+  }
+};
+
+} // namespace Stats
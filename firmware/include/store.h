@@ -0,0 +1,59 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+
+#include <SPIFFS.h>
+
+#include "protocol-impl.h"
+
+// Programs kept in the spiffs partition, one file per slot holding the raw
+// instructions, so that any instruction is read straight from its index.
+// The step timer interrupt is masked while the flash is busy: writes are
+// refused while motors move (see Program::store()), and playback reads ahead
+// in short chunks.
+namespace Store {
+
+constexpr uint8_t SLOTS = Protocol::PROGRAM_SLOTS;
+// Instructions held by a Reader
+constexpr unsigned WINDOW = 32;
+// Instructions read from flash at a time, bounds each masked interval
+constexpr unsigned CHUNK = 4;
+
+// Mount the partition (formatted on first use) and index the slots, returns
+// false if there is no storage
+bool init();
+// Write instructions at an offset: 0 replaces the slot, later chunks must
+// continue where the previous one ended. Returns an error message or nullptr.
+const char *write(uint8_t slot, uint16_t offset,
+                  const Protocol::Instruction *code, unsigned count);
+bool erase(uint8_t slot);
+// Instructions in a slot, 0 if empty or no such slot
+uint16_t size(uint8_t slot);
+void directory(Protocol::ProgramDirectory &out);
+
+// Random access to a stored program. Instructions [base, base + count) are
+// held in a ring of WINDOW slots, read ahead CHUNK at a time by prefetch()
+// so that sequential playback finds them in RAM. Half the window is kept
+// behind the last fetch for loops to jump back into.
+class Reader {
+  File file;
+  Protocol::Instruction window[WINDOW];
+  unsigned base = 0, count = 0, cursor = 0, limit = 0;
+  // Read up to CHUNK instructions past the window, false if none was read
+  bool fill();
+
+public:
+  bool open(uint8_t slot);
+  inline void close() {
+    file.close();
+    count = 0;
+  }
+  // Instruction at an index, nullptr if it cannot be read
+  const Protocol::Instruction *fetch(uint16_t index);
+  // Read ahead of the last fetch, once per agent tick
+  void prefetch();
+};
+
+} // namespace Store
@@ -0,0 +1,132 @@
+// =============================================================================
+// Non-blocking TMC2209 register access over the shared single wire UART.
+// Every driver shadows its registers: writes only mark a register dirty (and
+// are dropped if the value is unchanged), reads only request a refresh.
+// TMC::poll() moves one transaction at a time along the bus and never waits
+// for the UART, so the agent keeps draining RX while drivers are configured.
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+
+#include <Arduino.h>
+#include <cstdint>
+
+namespace TMC {
+
+// Registers accessed by the firmware, see the TMC2209 datasheet
+typedef enum : uint8_t {
+  GCONF = 0x00,
+  GSTAT = 0x01,
+  IFCNT = 0x02,
+  IOIN = 0x06,
+  IHOLD_IRUN = 0x10,
+  TPOWERDOWN = 0x11,
+  TSTEP = 0x12,
+  TPWMTHRS = 0x13,
+  TCOOLTHRS = 0x14,
+  SGTHRS = 0x40,
+  SG_RESULT = 0x41,
+  COOLCONF = 0x42,
+  MSCNT = 0x6A,
+  CHOPCONF = 0x6C,
+  DRV_STATUS = 0x6F,
+  PWMCONF = 0x70,
+} Register;
+
+// GCONF bits
+constexpr uint32_t I_SCALE_ANALOG = 1UL << 0;
+constexpr uint32_t EN_SPREADCYCLE = 1UL << 2;
+constexpr uint32_t PDN_DISABLE = 1UL << 6;
+constexpr uint32_t MSTEP_REG_SELECT = 1UL << 7;
+constexpr uint32_t MULTISTEP_FILT = 1UL << 8;
+
+// CHOPCONF fields
+constexpr uint32_t toff(uint8_t v) { return (v & 0xFUL) << 0; }
+constexpr uint32_t hstrt(uint8_t v) { return (v & 0x7UL) << 4; }
+constexpr uint32_t hend(uint8_t v) { return (v & 0xFUL) << 7; }
+constexpr uint32_t tbl(uint8_t v) { return (v & 0x3UL) << 15; }
+constexpr uint32_t VSENSE = 1UL << 17;
+constexpr uint32_t mres(uint8_t v) { return (v & 0xFUL) << 24; }
+constexpr uint32_t INTPOL = 1UL << 28;
+constexpr uint32_t DEDGE = 1UL << 29;
+
+// IHOLD_IRUN fields
+constexpr uint32_t ihold(uint8_t v) { return (v & 0x1FUL) << 0; }
+constexpr uint32_t irun(uint8_t v) { return (v & 0x1FUL) << 8; }
+constexpr uint32_t iholddelay(uint8_t v) { return (v & 0xFUL) << 16; }
+
+// COOLCONF fields
+constexpr uint32_t semin(uint8_t v) { return (v & 0xFUL) << 0; }
+constexpr uint32_t semax(uint8_t v) { return (v & 0xFUL) << 8; }
+constexpr uint32_t sedn(uint8_t v) { return (v & 0x3UL) << 13; }
+
+// PWMCONF reset value, includes pwm_autoscale and pwm_autograd
+constexpr uint32_t PWMCONF_DEFAULT = 0xC10D0024;
+
+// IOIN version field of a TMC2209
+constexpr uint8_t VERSION = 0x21;
+
+// Sense resistor of the driver boards (Ohm)
+constexpr float R_SENSE = 0.11f;
+
+// MRES value of a micro step resolution (1 - 256), 256 if not a power of 2
+uint8_t resolution(uint16_t micro_steps);
+// IHOLD_IRUN and the VSENSE bit of CHOPCONF for an RMS run current (mA),
+// hold current is half the run current.
+void current(uint16_t rms_current, uint32_t &ihold_irun, bool &vsense);
+
+class Driver {
+public:
+  static constexpr unsigned SLOTS = 16;
+  const uint8_t addr;
+
+private:
+  friend void poll();
+  uint32_t shadow[SLOTS] = {};
+  // Slots holding a value written to / read from the driver, and the ones
+  // set by writes (replayed when the driver comes back online)
+  uint16_t valid = 0, written = 0;
+  // Slots to be written / read by the engine
+  uint16_t dirty = 0, requested = 0;
+  // Failed attempts of the read in progress
+  uint8_t failures = 0;
+  // State of the link as of the last read
+  enum : uint8_t { UNKNOWN, UP, DOWN } link = UNKNOWN;
+
+  static int slot(uint8_t reg);
+
+public:
+  explicit Driver(uint8_t addr) : addr(addr) {}
+
+  // Queue a write, unless the register already holds the value
+  void write(Register reg, uint32_t value);
+  // Queue a read, completion is visible through settled()
+  void read(Register reg);
+  // True if no write or read of this register is outstanding
+  bool settled(Register reg) const;
+  // Last value written to or read from the register
+  uint32_t value(Register reg) const;
+  // Result of the last probe (IOIN read), updated in the background
+  inline bool online() const { return link == UP; }
+  // No transaction of this driver is outstanding
+  inline bool idle() const { return !dirty && !requested; }
+
+  // Engine callbacks, a read completed or an attempt failed
+  void received(int slot, uint32_t data);
+  void failed(int slot);
+};
+
+extern Driver drivers[3];
+
+// Start probing the drivers, call after the UART is up
+void begin();
+// Advance the bus by at most one transaction, call from the agent task only
+// (the drivers are not thread safe either)
+void poll();
+// Run the engine until all drivers are idle or the timeout expires (ms),
+// blocking, for setup only
+bool flush(unsigned long timeout);
+
+} // namespace TMC
@@ -11,25 +11,26 @@
 #include "debug.h"
 #include "global.h"
 
-auto constexpr LOG_BUF_SIZE = sizeof(Global::tx.frame.payload);
+auto constexpr LOG_BUF_SIZE = Protocol::Frame::PAYLOAD_SIZE;
 
 #define LOG(T, ...)                                                            \
   if (Global::Config::log) {                                                   \
-    __printf__(snprintf((char *)&Global::tx.frame.payload, LOG_BUF_SIZE, T,    \
-                        __VA_ARGS__));                                         \
+    char __log_buf__[LOG_BUF_SIZE];                                            \
+    __printf__(__log_buf__,                                                    \
+               snprintf(__log_buf__, LOG_BUF_SIZE, T, __VA_ARGS__));           \
   }
 
 #define WARN(T, ...)                                                           \
-  __printf__(snprintf((char *)&Global::tx.frame.payload, LOG_BUF_SIZE,         \
-                      "[WARN] " T, __VA_ARGS__))
+  do {                                                                         \
+    char __log_buf__[LOG_BUF_SIZE];                                            \
+    __printf__(__log_buf__, snprintf(__log_buf__, LOG_BUF_SIZE, "[WARN] " T,   \
+                                     __VA_ARGS__));                            \
+  } while (0)
 
-inline void __printf__(int ret) {
+inline void __printf__(const char *buf, int ret) {
   if (ret > 0) {
     ret = ret >= static_cast<int>(LOG_BUF_SIZE) ? LOG_BUF_SIZE - 1 : ret;
-    Global::tx.frame.header.set(0, Protocol::Method::LOG);
-    Global::tx.frame.payload_size = ret;
-    Global::tx.encode_frame();
-    Global::tx.send_frame();
+    Global::tx.send(0, Protocol::Method::LOG, Protocol::Property::NA, buf, ret);
   }
 }
 
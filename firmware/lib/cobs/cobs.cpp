@@ -9,17 +9,17 @@
 
 namespace COBS {
 
-int16_t RX::decode(bool (*available)(), char (*read)()) {
-  while (available()) {
+int16_t RX::decode(const uint8_t *&input, const uint8_t *end,
+                   uint8_t *output) {
+  while (input < end) {
     // Handle next byte
-    const auto byte = read();
-    raw[raw_index++] = byte;
+    const auto byte = *input++;
     // Check for reserved zero byte
     if (byte == 0) {
       if (counter == 0)
         continue; // Ignore extra zero bytes
       else if (counter == 1)
-        return length; // End of frame
+        return index; // End of frame
       else
         return ERR_UNEXPECTED_ZERO;
     }
@@ -35,10 +35,10 @@ int16_t RX::decode(bool (*available)(), char (*read)()) {
     if (counter == 1) {
       counter = byte;
       // Treat it as a valid zero data byte
-      data[index] = 0;
+      output[index] = 0;
     } else {
       // Handle non-zero byte
-      data[index] = byte;
+      output[index] = byte;
       counter--;
     }
     index++;
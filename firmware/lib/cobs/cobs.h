@@ -34,19 +34,18 @@ public:
   }
 };
 
-class RX : public Buffer {
+// Incremental decoder, state is kept across input chunks and decoded bytes
+// are written straight into the caller's buffer (COBS_MAX_CONTENT bytes).
+class RX {
 public:
-  template <typename T> inline const T &payload() {
-    return static_cast<T>(*data);
-  }
-  int16_t decode(bool (*available)(), char (*read)());
-  // For debugging
-  uint8_t raw[512];
-  unsigned raw_index = 0;
+  uint8_t index = 0;
+  uint8_t counter = 0;
   inline void reset() {
-    Buffer::reset();
-    raw_index = 0;
+    index = 0;
+    counter = 0;
   }
+  // Consumes input up to the end of the next frame, advancing `input`
+  int16_t decode(const uint8_t *&input, const uint8_t *end, uint8_t *output);
 };
 
 class TX : public Buffer {
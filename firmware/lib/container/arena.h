@@ -0,0 +1,137 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed pool of nodes shared by several lock-free, interrupt-safe FIFO queues
+// (linked lists through the pool), so that a busy queue can take the slots
+// idle queues do not need.
+// Links and positions are published with release and observed with acquire
+// ordering, same as RingBuffer.
+// Requirements:
+// - One producer for all queues (main thread) calls: writable(), space(),
+//   push(), completed(), release()
+// - One consumer for all queues (ISR) calls: readable(), peek(), pop()
+// Each queue holds one node at all times (the last one popped, or a dummy),
+// which is what keeps producer and consumer apart. Popped items stay valid
+// until the producer has seen them through completed() and release()d them,
+// only then are their nodes recycled into the pool.
+template <typename T, size_t N> class Arena {
+  static_assert(N < 0xFFFF, "Arena too large for 16 bit node indices");
+  static constexpr uint16_t NIL = 0xFFFF;
+
+  struct Node {
+    T item;
+    std::atomic<uint16_t> next;
+  };
+  Node nodes[N];
+  // Free list [Producer only]
+  uint16_t free = NIL;
+  unsigned available = 0, queues = 0;
+
+  inline uint16_t allocate() {
+    const uint16_t n = free;
+    free = nodes[n].next.load(std::memory_order_relaxed);
+    nodes[n].next.store(NIL, std::memory_order_relaxed);
+    available--;
+    return n;
+  }
+  inline void recycle(uint16_t n) {
+    nodes[n].next.store(free, std::memory_order_relaxed);
+    free = n;
+    available++;
+  }
+
+public:
+  inline Arena() {
+    for (size_t i = N; i-- > 0;)
+      recycle(i);
+  }
+
+  // Free slots, shared by all queues
+  inline unsigned space() const { return available; }
+  // Slots left once every queue holds its node
+  inline unsigned capacity() const { return N - queues; }
+
+  class Queue {
+    Arena &arena;
+    // Last node popped [Consumer writes, producer reads]
+    std::atomic<uint16_t> head;
+    // Last node pushed, last node released and oldest node not yet
+    // recycled [Producer only]
+    uint16_t tail, released, oldest;
+    // Free running item counters
+    std::atomic<unsigned> pushed{0}, popped{0};
+
+    inline uint16_t next(uint16_t n) const {
+      return arena.nodes[n].next.load(std::memory_order_acquire);
+    }
+
+  public:
+    inline Queue(Arena &arena) : arena(arena) {
+      tail = released = oldest = arena.allocate();
+      head.store(tail, std::memory_order_relaxed);
+      arena.queues++;
+    }
+
+    // Items queued, a snapshot from either side. Pushes are counted before
+    // the consumer can see them, so pushed never falls behind popped.
+    inline unsigned len() const {
+      const unsigned out = popped.load(std::memory_order_acquire);
+      return pushed.load(std::memory_order_acquire) - out;
+    }
+
+    // Consumer methods (called from ISR)
+    inline bool readable() const {
+      return next(head.load(std::memory_order_relaxed)) != NIL;
+    }
+    inline T &peek() {
+      // Must only call after readable() returns true
+      return arena.nodes[next(head.load(std::memory_order_relaxed))].item;
+    }
+    inline void pop() {
+      // Release: the item is read before the node is handed back
+      head.store(next(head.load(std::memory_order_relaxed)),
+                 std::memory_order_release);
+      popped.store(popped.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+
+    // Producer methods (called from main thread)
+    inline bool writable() const { return arena.available != 0; }
+    inline unsigned space() const { return arena.available; }
+    inline void push(const T &item) {
+      // Must only call after writable() returns true
+      const uint16_t n = arena.allocate();
+      arena.nodes[n].item = item;
+      pushed.store(pushed.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+      // Release: link the node only once it is complete, the consumer may
+      // pick it up right away
+      arena.nodes[tail].next.store(n, std::memory_order_release);
+      tail = n;
+    }
+    // Oldest item popped by the consumer and not yet released, nullptr if
+    // there is none. It stays in place until released.
+    inline const T *completed() const {
+      if (released == head.load(std::memory_order_acquire))
+        return nullptr;
+      return &arena.nodes[next(released)].item;
+    }
+    // Release the item returned by completed(), recycling the nodes the
+    // consumer is done with
+    inline void release() {
+      released = next(released);
+      while (oldest != released) {
+        const uint16_t n = oldest;
+        oldest = next(n);
+        arena.recycle(n);
+      }
+    }
+  };
+};
@@ -4,67 +4,147 @@
 // =============================================================================
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 
-// Lock-free, interrupt-safe single-producer single-consumer ring buffer
+// Contiguous run of items inside a RingBuffer
+template <typename T> struct Span {
+  T *data;
+  size_t size;
+};
+
+// Lock-free, interrupt-safe single-producer single-consumer ring buffer, safe
+// across cores: indices are published with release and observed with acquire
+// ordering, so items are complete before the other side can see them.
 // Requirements:
 // - SIZE must be a power of 2
-// - Producer (main thread) calls: writable(), write()
-// - Consumer (ISR) calls: readable(), peek(), pop()
+// - Producer (one task or ISR) calls: writable(), space(), push(),
+//   push_span(), commit(), write()
+// - Consumer (one task or ISR) calls: readable(), peek(), peek_span(), pop(),
+//   read()
+// - len() may be called from either side
 template <typename T, size_t S> class RingBuffer {
 private:
   T buffer[S];
-  volatile size_t head = 0; // Producer writes, consumer reads (next write pos)
-  volatile size_t tail = 0; // Consumer writes, producer reads (next read pos)
-  const size_t mask;        // SIZE - 1, for fast modulo with power-of-2
+  // Free running counters, head is only written by the producer (next write
+  // position), tail only by the consumer (next read position)
+  std::atomic<size_t> head{0};
+  std::atomic<size_t> tail{0};
+  static constexpr size_t mask = S - 1;
 
   // Compile-time check that SIZE is power of 2
   static constexpr bool is_power_of_2(size_t n) {
     return n > 0 && (n & (n - 1)) == 0;
   }
+  static_assert(is_power_of_2(S), "RingBuffer size must be a power of 2");
+
+  static inline size_t least(size_t a, size_t b) { return a < b ? a : b; }
 
 public:
-  inline RingBuffer() : mask(S - 1) {
-    static_assert(is_power_of_2(S), "RingBuffer size must be a power of 2");
-  }
+  static constexpr unsigned capacity() { return S; }
 
+  // Items queued, a snapshot from either side (the other side may change it
+  // right after)
   inline unsigned len() const {
-    // Warning: not atomic, may be inconsistent if head/tail change during call
-    return (head - tail) & mask;
+    // Tail first, head never falls behind it
+    const size_t t = tail.load(std::memory_order_acquire);
+    const size_t n = head.load(std::memory_order_acquire) - t;
+    return n < S ? n : S;
   }
 
-  // Consumer methods (called from ISR)
+  // Consumer methods
+
   inline bool readable() const {
-    // Read head (written by producer) - this is safe because producer only
-    // increments head
-    return head != tail;
+    return head.load(std::memory_order_acquire) !=
+           tail.load(std::memory_order_relaxed);
   }
   inline T &peek() {
     // Must only call after readable() returns true
-    return buffer[tail & mask];
+    return buffer[tail.load(std::memory_order_relaxed) & mask];
   }
   inline void pop() {
-    // Update tail - this makes one more slot writable for producer
-    // Use masking instead of modulo for efficiency
-    // Memory barrier ensures data read completes before tail update
-    asm volatile("" ::: "memory");
-    tail = (tail + 1) & mask;
+    // Release: the item is read before its slot is handed back
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+  // Longest contiguous run of queued items, starting with the oldest. Empty
+  // if there are none, shorter than len() where the ring wraps around.
+  inline Span<T> peek_span() {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    const size_t queued = head.load(std::memory_order_acquire) - t;
+    const size_t offset = t & mask;
+    return {buffer + offset, least(queued, S - offset)};
+  }
+  // Copy up to `count` of the oldest items without removing them, returns
+  // the number copied
+  inline size_t peek(T *items, size_t count) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    count = least(count, head.load(std::memory_order_acquire) - t);
+    const size_t offset = t & mask;
+    const size_t first = least(count, S - offset);
+    for (size_t i = 0; i < first; i++)
+      items[i] = buffer[offset + i];
+    for (size_t i = first; i < count; i++)
+      items[i] = buffer[i - first];
+    return count;
+  }
+  // Remove `count` items (at most len()), e.g. after consuming a peek_span()
+  inline void pop(size_t count) {
+    tail.store(tail.load(std::memory_order_relaxed) + count,
+               std::memory_order_release);
   }
+  // Move up to `count` of the oldest items out, returns the number moved
+  inline size_t read(T *items, size_t count) {
+    count = peek(items, count);
+    pop(count);
+    return count;
+  }
+
+  // Producer methods
 
-  // Producer methods (called from main thread)
   inline bool writable() const {
-    // Read tail (written by consumer) - safe because consumer only increments
-    // tail Check if next write position would collide with tail
-    return ((head + 1) & mask) != (tail & mask);
+    return head.load(std::memory_order_relaxed) -
+               tail.load(std::memory_order_acquire) <
+           S;
+  }
+  inline unsigned space() const {
+    // Slots writable in a row. Only meaningful for the producer, consumer
+    // may free more slots concurrently (never fewer).
+    return S - (head.load(std::memory_order_relaxed) -
+                tail.load(std::memory_order_acquire));
   }
-
   inline void push(const T &item) {
     // Must only call after writable() returns true
-    // CRITICAL: Write data BEFORE updating head index
-    // This ensures consumer never sees uninitialized data
-    buffer[head & mask] = item;
-    // Memory barrier ensures data write completes before head update
-    asm volatile("" ::: "memory");
-    head = (head + 1) & mask;
+    const size_t h = head.load(std::memory_order_relaxed);
+    buffer[h & mask] = item;
+    // Release: the item is written before the consumer can see it
+    head.store(h + 1, std::memory_order_release);
+  }
+  // Longest contiguous run of free slots, to be filled in place and then
+  // published with commit()
+  inline Span<T> push_span() {
+    const size_t h = head.load(std::memory_order_relaxed);
+    const size_t free = S - (h - tail.load(std::memory_order_acquire));
+    const size_t offset = h & mask;
+    return {buffer + offset, least(free, S - offset)};
+  }
+  // Publish `count` slots filled through push_span()
+  inline void commit(size_t count) {
+    head.store(head.load(std::memory_order_relaxed) + count,
+               std::memory_order_release);
+  }
+  // Copy up to `count` items in, all published at once, returns the number
+  // copied
+  inline size_t write(const T *items, size_t count) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    count = least(count, S - (h - tail.load(std::memory_order_acquire)));
+    const size_t offset = h & mask;
+    const size_t first = least(count, S - offset);
+    for (size_t i = 0; i < first; i++)
+      buffer[offset + i] = items[i];
+    for (size_t i = first; i < count; i++)
+      buffer[i - first] = items[i];
+    head.store(h + count, std::memory_order_release);
+    return count;
   }
 };
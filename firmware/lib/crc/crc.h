@@ -0,0 +1,25 @@
+// =============================================================================
+// Table driven CRC-16/X-25 (reflected polynomial 0x1021)
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace CRC {
+
+extern const uint16_t table[256];
+
+// CRC-16/X-25: init 0xFFFF, reflected in/out, final XOR 0xFFFF.
+// Check value for "123456789" is 0x906E.
+inline uint16_t crc16(const uint8_t *data, size_t size) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < size; i++)
+    crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xFF];
+  return crc ^ 0xFFFF;
+}
+
+} // namespace CRC
@@ -5,21 +5,13 @@
 
 #pragma once
 #include "freertos/FreeRTOS.h" // IWYU pragma: export
+#include "log.h"               // IWYU pragma: export
 #include "stdio.h"
 
-extern char debug_log_buffer[];
-
+// Writes to the debug port, may accept less than `size` but never blocks
 size_t debug_write(void *buf, size_t size);
 
-#define DEBUG_LOG_BUFFER_SIZE 1024
-#define DEBUG(...)                                                             \
-  {                                                                            \
-    int __debug_ret__ =                                                        \
-        snprintf(debug_log_buffer, DEBUG_LOG_BUFFER_SIZE, __VA_ARGS__);        \
-    if (__debug_ret__ > 0) {                                                   \
-      debug_write(debug_log_buffer, __debug_ret__);                            \
-    }                                                                          \
-  }
+#define DEBUG(...) DEBUG_LOG(Debug::INFO, __VA_ARGS__)
 
 struct __Trace__ {
   const char *file;
@@ -0,0 +1,94 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+
+#include "log.h"
+#include "debug.h"
+#include "esp32-hal.h"
+#include "ring-buffer.h"
+
+namespace Debug {
+
+volatile Level verbosity = INFO;
+volatile unsigned dropped = 0;
+
+// Encoded records, written by both cores taking turns under the lock and
+// drained by flush() without it
+static RingBuffer<uint8_t, 4096> ring;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+Record::Record(Level level, const char *fmt) {
+  const uint32_t id = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(fmt));
+  const uint32_t time = micros();
+  memcpy(data, &id, sizeof(id));
+  memcpy(data + 4, &time, sizeof(time));
+  data[8] = (xPortGetCoreID() << 7) | level;
+  size = 9;
+}
+
+void Record::blob(Tag tag, const void *src, size_t len) {
+  if (size + 2 > sizeof(data))
+    return;
+  if (len > sizeof(data) - size - 2)
+    len = sizeof(data) - size - 2;
+  data[size++] = tag;
+  data[size++] = len;
+  if (len)
+    memcpy(data + size, src, len);
+  size += len;
+}
+
+void Record::commit() {
+  // Encode outside of the critical section
+  COBS::TX cobs;
+  cobs.encode(data, size);
+  const size_t len = cobs.size();
+  portENTER_CRITICAL_SAFE(&lock);
+  if (ring.space() < len)
+    dropped = dropped + 1;
+  else
+    ring.write(cobs.payload(), len);
+  portEXIT_CRITICAL_SAFE(&lock);
+}
+
+// Looked up by content in the firmware ELF, see scripts/debug-log.py
+static const char MARKER[] = "Debug log started, verbosity %u\n";
+
+void begin() {
+  Record record(INFO, MARKER);
+  record.arg(static_cast<unsigned>(verbosity));
+  record.commit();
+}
+
+void dump(Level level, const char *label, const void *data, size_t size) {
+  if (level > verbosity)
+    return;
+  Record record(level, "%s [%s]\n");
+  record.arg(label);
+  record.blob(BIN, data, size);
+  record.commit();
+}
+
+size_t flush() {
+  size_t total = 0;
+  for (int i = 0; i < 2; i++) {
+    const auto span = ring.peek_span();
+    if (span.size == 0)
+      break;
+    const size_t len = debug_write(span.data, span.size);
+    ring.pop(len);
+    total += len;
+    if (len < span.size)
+      return total; // Port is full, retry on next flush
+  }
+  portENTER_CRITICAL_SAFE(&lock);
+  const unsigned lost = dropped;
+  dropped = 0;
+  portEXIT_CRITICAL_SAFE(&lock);
+  if (lost)
+    DEBUG_WARN("Debug log dropped %u records\n", lost);
+  return total;
+}
+
+} // namespace Debug
@@ -0,0 +1,133 @@
+// =============================================================================
+// Binary debug log with deferred formatting. Call sites record the address of
+// their format string and the raw arguments only, formatting is done on the
+// host by scripts/debug-log.py, which looks the format strings up in the
+// firmware ELF. Records are COBS framed into a ring shared by both cores, and
+// drained to the debug port by Debug::flush().
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "cobs.h"
+
+namespace Debug {
+
+typedef enum : uint8_t {
+  SILENT = 0,
+  ERROR = 1,
+  WARNING = 2,
+  INFO = 3,
+  VERBOSE = 4,
+} Level;
+
+// Records above this level are discarded at the call site
+extern volatile Level verbosity;
+// Records lost to a full ring since the last flush
+extern volatile unsigned dropped;
+
+// Every argument is stored as its tag followed by the value (little endian),
+// strings and byte blobs as tag, length (u8) and content.
+typedef enum : uint8_t {
+  I32 = 'i',
+  U32 = 'u',
+  I64 = 'l',
+  U64 = 'L',
+  F64 = 'f',
+  STR = 's',
+  BIN = 'b',
+} Tag;
+
+// Record layout: format address (u32), timestamp (u32, us), core << 7 | level,
+// followed by the tagged arguments. Arguments that do not fit are dropped.
+class Record {
+  uint8_t data[COBS_MAX_CONTENT];
+  size_t size = 0;
+
+  template <typename T> inline void tagged(Tag tag, T value) {
+    if (size + 1 + sizeof(T) > sizeof(data))
+      return;
+    data[size++] = tag;
+    memcpy(data + size, &value, sizeof(T));
+    size += sizeof(T);
+  }
+
+public:
+  Record(Level level, const char *fmt);
+
+  // Tag, length and content, truncated to what is left of the record
+  void blob(Tag tag, const void *src, size_t len);
+
+  template <typename T>
+  inline typename std::enable_if<std::is_integral<T>::value>::type arg(T v) {
+    if (sizeof(T) > 4) {
+      if (std::is_signed<T>::value)
+        tagged(I64, static_cast<int64_t>(v));
+      else
+        tagged(U64, static_cast<uint64_t>(v));
+    } else if (std::is_signed<T>::value) {
+      tagged(I32, static_cast<int32_t>(v));
+    } else {
+      tagged(U32, static_cast<uint32_t>(v));
+    }
+  }
+  template <typename T>
+  inline typename std::enable_if<std::is_enum<T>::value>::type arg(T v) {
+    arg(static_cast<typename std::underlying_type<T>::type>(v));
+  }
+  template <typename T>
+  inline typename std::enable_if<std::is_floating_point<T>::value>::type
+  arg(T v) {
+    tagged(F64, static_cast<double>(v));
+  }
+  // Strings are copied, the pointer may be gone by the time of formatting
+  inline void arg(const char *s) { blob(STR, s, s ? strlen(s) : 0); }
+  template <typename T> inline void arg(const T *p) {
+    tagged(U32, static_cast<uint32_t>(reinterpret_cast<uintptr_t>(p)));
+  }
+
+  inline void args() {}
+  template <typename T, typename... R> inline void args(T first, R... rest) {
+    arg(first);
+    args(rest...);
+  }
+
+  // Frame the record and queue it for flush()
+  void commit();
+};
+
+// Never called, lets the compiler check call sites against their format
+inline void __attribute__((format(printf, 1, 2))) check(const char *, ...) {}
+
+// Logs the start marker, which also lets the host decoder relocate format
+// addresses of position independent (native) builds
+void begin();
+// Records a byte dump as "<label> [XX XX ...]"
+void dump(Level level, const char *label, const void *data, size_t size);
+// Writes queued records to the debug port without blocking, returns bytes
+// written. Call periodically from one task only.
+size_t flush();
+
+} // namespace Debug
+
+// Format strings must be literals, the record only carries their address
+#define DEBUG_LOG(LEVEL, FMT, ...)                                             \
+  do {                                                                         \
+    if (false)                                                                 \
+      Debug::check(FMT __VA_OPT__(, ) __VA_ARGS__);                            \
+    if ((LEVEL) <= Debug::verbosity) {                                         \
+      Debug::Record __debug_record__((LEVEL), "" FMT);                         \
+      __debug_record__.args(__VA_ARGS__);                                      \
+      __debug_record__.commit();                                               \
+    }                                                                          \
+  } while (0)
+
+#define DEBUG_ERROR(...) DEBUG_LOG(Debug::ERROR, __VA_ARGS__)
+#define DEBUG_WARN(...) DEBUG_LOG(Debug::WARNING, __VA_ARGS__)
+#define DEBUG_VERBOSE(...) DEBUG_LOG(Debug::VERBOSE, __VA_ARGS__)
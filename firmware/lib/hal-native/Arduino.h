@@ -0,0 +1,114 @@
+// =============================================================================
+// Simulated Arduino-ESP32 Core for Host Builds
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "esp32-hal.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "pins_arduino.h"
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+#define OPEN_DRAIN 0x10
+#define OUTPUT_OPEN_DRAIN 0x13
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define SERIAL_8N1 0x800001c
+
+// GPIO levels live in the simulated register file (soc/gpio_struct.h)
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void analogWrite(uint8_t pin, int value);
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode);
+
+class Stream {
+public:
+  virtual ~Stream() {}
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  inline size_t write(const char *buffer, size_t size) {
+    return write(reinterpret_cast<const uint8_t *>(buffer), size);
+  }
+  inline size_t write(uint8_t c) { return write(&c, 1); }
+};
+
+// Serial ports are backed by host file descriptors:
+//   PTY     - pseudo terminal for the host driver, connected while open
+//   STDERR  - write only, for the debug console
+//   TMC     - fake TMC2209 drivers (see tmc2209.cpp)
+//   NONE    - discards writes, never receives
+class HardwareSerial : public Stream {
+public:
+  enum Backend { PTY, STDERR, TMC, NONE };
+
+private:
+  const Backend backend;
+  int fd = -1;
+  uint8_t buffer[4096];
+  size_t head = 0, tail = 0;
+
+public:
+  HardwareSerial(Backend backend) : backend(backend) {}
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1,
+             int8_t rx = -1, int8_t tx = -1);
+  int available() override;
+  int read() override;
+  size_t read(uint8_t *buffer, size_t size);
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Stream::write;
+  int availableForWrite();
+  // True while a host holds the port open (DTR on the target)
+  operator bool() const;
+};
+
+extern HardwareSerial Serial, Serial1, Serial2;
+
+typedef enum {
+  ESP_RST_UNKNOWN,
+  ESP_RST_POWERON,
+  ESP_RST_EXT,
+  ESP_RST_SW,
+  ESP_RST_PANIC,
+  ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT,
+  ESP_RST_WDT,
+  ESP_RST_DEEPSLEEP,
+  ESP_RST_BROWNOUT,
+  ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+esp_reset_reason_t esp_reset_reason();
+
+class EspClass {
+public:
+  // Host time scaled to F_CPU, wraps like the Xtensa CCOUNT register
+  uint32_t getCycleCount();
+  // Terminates the simulation
+  void restart();
+};
+
+extern EspClass ESP;
+
+void setup();
+void loop();
@@ -0,0 +1,49 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+// Simulated SPIFFS, files live in the host directory named by TSC_SPIFFS
+// (flat, like SPIFFS itself). Without it, begin() fails and the firmware
+// runs without storage.
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+class File {
+  std::shared_ptr<FILE> file;
+
+public:
+  File() = default;
+  explicit File(FILE *f) : file(f, fclose) {}
+  inline explicit operator bool() const { return file != nullptr; }
+  size_t read(uint8_t *buffer, size_t size);
+  size_t write(const uint8_t *buffer, size_t size);
+  bool seek(uint32_t pos);
+  size_t position() const;
+  size_t size() const;
+  inline void close() { file.reset(); }
+};
+
+class SPIFFSFS {
+public:
+  bool begin(bool formatOnFail = false);
+  File open(const char *path, const char *mode = FILE_READ);
+  bool exists(const char *path);
+  bool remove(const char *path);
+  size_t totalBytes();
+  size_t usedBytes();
+};
+
+} // namespace fs
+
+using fs::File;
+
+extern fs::SPIFFSFS SPIFFS;
@@ -0,0 +1,23 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+#include <cstdint>
+
+// Simulated hardware timer, counting at 80 MHz / divider from timerBegin().
+// Alarms are delivered on a dedicated thread (reported as core 1), which
+// sleeps until shortly before the deadline and busy waits the rest, so that
+// step timing stays close to the target.
+typedef struct hw_timer_s hw_timer_t;
+
+hw_timer_t *timerBegin(uint8_t num, uint16_t divider, bool countUp);
+void timerAttachInterrupt(hw_timer_t *timer, void (*isr)(), bool edge);
+void timerAlarmWrite(hw_timer_t *timer, uint64_t alarm, bool autoreload);
+void timerAlarmEnable(hw_timer_t *timer);
+void timerAlarmDisable(hw_timer_t *timer);
+uint64_t timerRead(hw_timer_t *timer);
+
+unsigned long micros();
+unsigned long millis();
+void delay(uint32_t ms);
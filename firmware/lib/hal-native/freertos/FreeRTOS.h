@@ -0,0 +1,46 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+#include <cstdint>
+
+// Tasks are backed by host threads, the core affinity is only recorded so
+// that xPortGetCoreID() (and thus TRACE) behaves as on the target.
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define configMAX_PRIORITIES 25
+#define pdPASS 1
+#define pdFAIL 0
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name,
+                                   uint32_t stack, void *arg,
+                                   unsigned priority, TaskHandle_t *handle,
+                                   int core);
+void vTaskDelete(TaskHandle_t task);
+int xPortGetCoreID();
+
+// Critical sections are plain spinlocks shared between threads
+typedef struct {
+  volatile uint32_t owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+inline void portENTER_CRITICAL(portMUX_TYPE *mux) {
+  uint32_t unlocked = 0;
+  while (!__atomic_compare_exchange_n(&mux->owner, &unlocked, 1, false,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    unlocked = 0;
+}
+
+inline void portEXIT_CRITICAL(portMUX_TYPE *mux) {
+  __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+}
+
+#define portENTER_CRITICAL_ISR portENTER_CRITICAL
+#define portEXIT_CRITICAL_ISR portEXIT_CRITICAL
+#define portENTER_CRITICAL_SAFE portENTER_CRITICAL
+#define portEXIT_CRITICAL_SAFE portEXIT_CRITICAL
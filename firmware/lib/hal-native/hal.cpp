@@ -0,0 +1,164 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include <Arduino.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <pthread.h>
+#include <soc/gpio_struct.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+static const Clock::time_point boot = Clock::now();
+
+static inline uint64_t elapsed_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              boot)
+      .count();
+}
+
+unsigned long micros() { return elapsed_ns() / 1000; }
+unsigned long millis() { return elapsed_ns() / 1000000; }
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// =============================================================================
+// GPIO
+// =============================================================================
+
+gpio_dev_t GPIO = {
+    .out = 0,
+    .out_w1ts = {&GPIO.out, true},
+    .out_w1tc = {&GPIO.out, false},
+    .out1 = {0},
+    .out1_w1ts = {{&GPIO.out1.val, true}},
+    .out1_w1tc = {{&GPIO.out1.val, false}},
+    .in = 0,
+    .in1 = {0},
+};
+
+void pinMode(uint8_t, uint8_t) {}
+
+int digitalRead(uint8_t pin) {
+  const uint32_t mask = 1UL << (pin & 31);
+  if (pin < 32)
+    return ((GPIO.out | GPIO.in) & mask) ? HIGH : LOW;
+  return ((GPIO.out1.val | GPIO.in1.val) & mask) ? HIGH : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  const uint32_t mask = 1UL << (pin & 31);
+  if (pin < 32)
+    value ? (GPIO.out_w1ts = mask) : (GPIO.out_w1tc = mask);
+  else
+    value ? (GPIO.out1_w1ts.val = mask) : (GPIO.out1_w1tc.val = mask);
+}
+
+void analogWrite(uint8_t, int) {}
+
+// Environment variable naming a FIFO to drive inputs from, one "<pin> <level>"
+// per line, e.g. `echo 4 1 > $TSC_GPIO`. Edges call the attached handler.
+static constexpr auto GPIO_FIFO_ENV = "TSC_GPIO";
+static constexpr uint8_t GPIO_PINS = 64;
+static void (*volatile gpio_handlers[GPIO_PINS])() = {};
+static int gpio_modes[GPIO_PINS] = {};
+
+static void gpio_input(const char *path) {
+  for (;;) {
+    FILE *fifo = fopen(path, "r");
+    if (!fifo) {
+      perror("fopen");
+      return;
+    }
+    unsigned pin, level;
+    while (fscanf(fifo, "%u %u", &pin, &level) == 2) {
+      if (pin >= GPIO_PINS)
+        continue;
+      const uint32_t mask = 1UL << (pin & 31);
+      volatile uint32_t &in = pin < 32 ? GPIO.in : GPIO.in1.val;
+      if (!(in & mask) == !level)
+        continue;
+      level ? (in |= mask) : (in &= ~mask);
+      if (gpio_handlers[pin] && gpio_modes[pin] & (level ? RISING : FALLING))
+        gpio_handlers[pin]();
+    }
+    // Writer closed the FIFO, wait for the next one
+    fclose(fifo);
+  }
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(), int mode) {
+  if (pin >= GPIO_PINS)
+    return;
+  gpio_modes[pin] = mode;
+  gpio_handlers[pin] = handler;
+  static bool started = false;
+  const char *path = getenv(GPIO_FIFO_ENV);
+  if (started || !path)
+    return;
+  started = true;
+  unlink(path);
+  if (mkfifo(path, 0666)) {
+    perror("mkfifo");
+    return;
+  }
+  std::thread(gpio_input, path).detach();
+}
+
+// =============================================================================
+// System
+// =============================================================================
+
+EspClass ESP;
+
+uint32_t EspClass::getCycleCount() {
+  return elapsed_ns() * (F_CPU / 1000000) / 1000;
+}
+
+void EspClass::restart() {
+  fprintf(stderr, "ESP.restart() called, terminating simulation\n");
+  exit(EXIT_FAILURE);
+}
+
+esp_reset_reason_t esp_reset_reason() { return ESP_RST_POWERON; }
+
+// =============================================================================
+// Tasks
+// =============================================================================
+
+static thread_local int core_id = 0;
+
+int xPortGetCoreID() { return core_id; }
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name,
+                                   uint32_t, void *arg, unsigned,
+                                   TaskHandle_t *handle, int core) {
+  std::thread thread([=]() {
+    core_id = core;
+    task(arg);
+  });
+  pthread_setname_np(thread.native_handle(), name);
+  if (handle)
+    *handle = reinterpret_cast<TaskHandle_t>(thread.native_handle());
+  thread.detach();
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  // Only self deletion is used by the firmware
+  if (task == nullptr)
+    pthread_exit(nullptr);
+}
+
+int main() {
+  setup();
+  while (true) {
+    loop();
+    delay(1);
+  }
+}
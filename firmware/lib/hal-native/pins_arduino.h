@@ -0,0 +1,16 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+#include <cstdint>
+
+// Arduino Nano ESP32 pin map (BOARD_USES_HW_GPIO_NUMBERS)
+static const uint8_t D0 = 44, D1 = 43, D2 = 5, D3 = 6, D4 = 7, D5 = 8, D6 = 9,
+                     D7 = 10, D8 = 17, D9 = 18, D10 = 21, D11 = 38, D12 = 47,
+                     D13 = 48;
+static const uint8_t A0 = 1, A1 = 2, A2 = 3, A3 = 4, A4 = 11, A5 = 12, A6 = 13,
+                     A7 = 14;
+static const uint8_t B0 = 46, B1 = 0;
+static const uint8_t LED_BUILTIN = 48, LED_RED = 46, LED_GREEN = 0,
+                     LED_BLUE = 45;
@@ -0,0 +1,138 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include <Arduino.h>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+// USB CDC console -> pseudo terminal, UART1 (TMC2209 bus) -> fake drivers,
+// UART2 (debug console) -> stderr
+HardwareSerial Serial(HardwareSerial::PTY);
+HardwareSerial Serial1(HardwareSerial::TMC);
+HardwareSerial Serial2(HardwareSerial::STDERR);
+
+// Echo and replies of the fake drivers to the bytes sent
+size_t fake_tmc2209(const uint8_t *data, size_t size, uint8_t *out,
+                    size_t space);
+
+// Environment variable naming a path to symlink the pseudo terminal to
+static constexpr auto SERIAL_LINK_ENV = "TSC_SERIAL";
+
+void HardwareSerial::begin(unsigned long, uint32_t, int8_t, int8_t) {
+  if (fd >= 0)
+    return;
+  switch (backend) {
+  case PTY: {
+    fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+      perror("posix_openpt");
+      exit(EXIT_FAILURE);
+    }
+    termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    const char *name = ptsname(fd);
+    // Open and close the slave once, the master reports a hang up from then
+    // on until a host opens the port.
+    close(open(name, O_RDWR | O_NOCTTY));
+    const char *link = getenv(SERIAL_LINK_ENV);
+    if (link) {
+      unlink(link);
+      if (symlink(name, link))
+        perror("symlink");
+    }
+    // Stderr is the (binary) debug port
+    printf("Serial port: %s%s%s\n", name, link ? " -> " : "", link ? link : "");
+    fflush(stdout);
+    break;
+  }
+  case STDERR:
+    fd = STDERR_FILENO;
+    break;
+  case TMC:
+  case NONE:
+    break;
+  }
+}
+
+HardwareSerial::operator bool() const {
+  if (backend != PTY)
+    return true;
+  if (fd < 0)
+    return false;
+  // The master side reports a hang up while no host has the port open
+  pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+  return poll(&pfd, 1, 0) >= 0 && !(pfd.revents & POLLHUP);
+}
+
+int HardwareSerial::available() {
+  if (backend == TMC)
+    return tail - head;
+  if (backend != PTY || fd < 0)
+    return 0;
+  if (head == tail) {
+    head = tail = 0;
+    const auto len = ::read(fd, buffer, sizeof(buffer));
+    if (len > 0)
+      tail = len;
+  }
+  return tail - head;
+}
+
+int HardwareSerial::read() {
+  if (!available())
+    return -1;
+  return buffer[head++];
+}
+
+size_t HardwareSerial::read(uint8_t *data, size_t size) {
+  size_t len = 0;
+  while (len < size && available()) {
+    const size_t n = tail - head < size - len ? tail - head : size - len;
+    memcpy(data + len, buffer + head, n);
+    head += n;
+    len += n;
+  }
+  return len;
+}
+
+int HardwareSerial::availableForWrite() {
+  if (backend != PTY)
+    return 4096;
+  if (fd < 0)
+    return 0;
+  pollfd pfd = {.fd = fd, .events = POLLOUT, .revents = 0};
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLOUT) ? 4096 : 0;
+}
+
+size_t HardwareSerial::write(const uint8_t *data, size_t size) {
+  if (backend == TMC) {
+    if (head == tail)
+      head = tail = 0;
+    tail += fake_tmc2209(data, size, buffer + tail, sizeof(buffer) - tail);
+    return size;
+  }
+  if (fd < 0)
+    return size;
+  size_t sent = 0;
+  while (sent < size) {
+    const auto len = ::write(fd, data + sent, size - sent);
+    if (len > 0) {
+      sent += len;
+    } else if (len < 0 && errno == EAGAIN) {
+      // Host is not draining the port, wait a little like the USB CDC stack
+      pollfd pfd = {.fd = fd, .events = POLLOUT, .revents = 0};
+      if (poll(&pfd, 1, 100) <= 0 || (pfd.revents & POLLHUP))
+        break;
+    } else {
+      break;
+    }
+  }
+  return size;
+}
@@ -0,0 +1,43 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#pragma once
+#include <cstdint>
+
+// Simulated GPIO register file. Writes to the W1TS/W1TC registers atomically
+// set/clear bits of the output register they belong to, like on the target.
+class gpio_w1_reg_t {
+  volatile uint32_t *const target;
+  const bool set;
+
+public:
+  constexpr gpio_w1_reg_t(volatile uint32_t *target, bool set)
+      : target(target), set(set) {}
+  inline gpio_w1_reg_t &operator=(uint32_t mask) {
+    if (set)
+      __atomic_or_fetch(target, mask, __ATOMIC_RELAXED);
+    else
+      __atomic_and_fetch(target, ~mask, __ATOMIC_RELAXED);
+    return *this;
+  }
+};
+
+typedef struct {
+  volatile uint32_t val;
+} gpio_reg_t;
+
+typedef struct {
+  gpio_w1_reg_t val;
+} gpio_w1_bank_t;
+
+typedef struct {
+  volatile uint32_t out;
+  gpio_w1_reg_t out_w1ts, out_w1tc;
+  gpio_reg_t out1;
+  gpio_w1_bank_t out1_w1ts, out1_w1tc;
+  volatile uint32_t in;
+  gpio_reg_t in1;
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
@@ -0,0 +1,85 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include "SPIFFS.h"
+#include <cstdlib>
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr auto SPIFFS_DIR_ENV = "TSC_SPIFFS";
+// Same as the spiffs partition in partitions.csv
+static constexpr size_t CAPACITY = 0x160000;
+
+fs::SPIFFSFS SPIFFS;
+
+static std::string root;
+
+static std::string resolve(const char *path) { return root + path; }
+
+size_t fs::File::read(uint8_t *buffer, size_t size) {
+  return file ? fread(buffer, 1, size, file.get()) : 0;
+}
+
+size_t fs::File::write(const uint8_t *buffer, size_t size) {
+  return file ? fwrite(buffer, 1, size, file.get()) : 0;
+}
+
+bool fs::File::seek(uint32_t pos) {
+  return file && fseek(file.get(), pos, SEEK_SET) == 0;
+}
+
+size_t fs::File::position() const {
+  return file ? ftell(file.get()) : 0;
+}
+
+size_t fs::File::size() const {
+  struct stat st;
+  if (!file || fstat(fileno(file.get()), &st))
+    return 0;
+  return st.st_size;
+}
+
+bool fs::SPIFFSFS::begin(bool) {
+  const char *dir = getenv(SPIFFS_DIR_ENV);
+  if (!dir)
+    return false;
+  mkdir(dir, 0777);
+  root = dir;
+  return true;
+}
+
+fs::File fs::SPIFFSFS::open(const char *path, const char *mode) {
+  if (root.empty())
+    return File();
+  // Writers flush on close, readers see complete files
+  FILE *f = fopen(resolve(path).c_str(), mode[0] == 'r' ? "rb" : mode);
+  return f ? File(f) : File();
+}
+
+bool fs::SPIFFSFS::exists(const char *path) {
+  return !root.empty() && access(resolve(path).c_str(), F_OK) == 0;
+}
+
+bool fs::SPIFFSFS::remove(const char *path) {
+  return !root.empty() && unlink(resolve(path).c_str()) == 0;
+}
+
+size_t fs::SPIFFSFS::totalBytes() { return root.empty() ? 0 : CAPACITY; }
+
+size_t fs::SPIFFSFS::usedBytes() {
+  size_t used = 0;
+  DIR *dir = root.empty() ? nullptr : opendir(root.c_str());
+  if (!dir)
+    return 0;
+  while (const auto entry = readdir(dir)) {
+    struct stat st;
+    const auto path = root + "/" + entry->d_name;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+      used += st.st_size;
+  }
+  closedir(dir);
+  return used;
+}
@@ -0,0 +1,98 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include <Arduino.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Remaining time below which the timer thread busy waits instead of sleeping
+static constexpr uint64_t SPIN_NS = 200000;
+
+struct hw_timer_s {
+  std::chrono::steady_clock::time_point origin;
+  uint16_t divider;
+  void (*isr)() = nullptr;
+  std::atomic<uint64_t> alarm{0};
+  std::atomic<bool> enabled{false};
+  std::mutex mutex;
+  std::condition_variable update;
+};
+
+static inline uint64_t ticks_to_ns(const hw_timer_t *timer, uint64_t ticks) {
+  return ticks * 1000 * timer->divider / 80;
+}
+
+uint64_t timerRead(hw_timer_t *timer) {
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - timer->origin)
+                      .count();
+  return ns * 80 / (1000 * timer->divider);
+}
+
+static void run(hw_timer_t *timer) {
+  std::unique_lock<std::mutex> lock(timer->mutex);
+  while (true) {
+    if (!timer->enabled || !timer->isr) {
+      timer->update.wait(lock);
+      continue;
+    }
+    const uint64_t alarm = timer->alarm, now = timerRead(timer);
+    if (now < alarm) {
+      const uint64_t remaining = ticks_to_ns(timer, alarm - now);
+      if (remaining > SPIN_NS) {
+        timer->update.wait_for(
+            lock, std::chrono::nanoseconds(remaining - SPIN_NS / 2));
+        continue;
+      }
+      lock.unlock();
+      while (timer->enabled && timerRead(timer) < timer->alarm)
+        ;
+      lock.lock();
+      continue;
+    }
+    // One shot alarm, the ISR re-arms the timer if needed
+    timer->enabled = false;
+    lock.unlock();
+    timer->isr();
+    lock.lock();
+  }
+}
+
+hw_timer_t *timerBegin(uint8_t, uint16_t divider, bool) {
+  auto timer = new hw_timer_t;
+  timer->origin = std::chrono::steady_clock::now();
+  timer->divider = divider;
+  xTaskCreatePinnedToCore(
+      [](void *arg) { run(static_cast<hw_timer_t *>(arg)); }, "timer", 0,
+      timer, configMAX_PRIORITIES - 1, nullptr, 1);
+  return timer;
+}
+
+void timerAttachInterrupt(hw_timer_t *timer, void (*isr)(), bool) {
+  std::lock_guard<std::mutex> lock(timer->mutex);
+  timer->isr = isr;
+  timer->update.notify_one();
+}
+
+// Alarm updates take the timer mutex so that the timer thread can not miss
+// them between checking the alarm and going to sleep.
+void timerAlarmWrite(hw_timer_t *timer, uint64_t alarm, bool) {
+  std::lock_guard<std::mutex> lock(timer->mutex);
+  timer->alarm = alarm;
+  timer->update.notify_one();
+}
+
+void timerAlarmEnable(hw_timer_t *timer) {
+  std::lock_guard<std::mutex> lock(timer->mutex);
+  timer->enabled = true;
+  timer->update.notify_one();
+}
+
+void timerAlarmDisable(hw_timer_t *timer) {
+  std::lock_guard<std::mutex> lock(timer->mutex);
+  timer->enabled = false;
+}
@@ -0,0 +1,101 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Fake TMC2209 drivers (UART addresses 0-2) on the UART1 bus. Writes are
+// stored and counted in IFCNT, reads reply with the stored value and IOIN
+// reports version 0x21. The motors never turn: TSTEP and DRV_STATUS report
+// standstill at the run current. Like the single wire bus on the board, every byte
+// sent is echoed back. Set TSC_TMC_OFFLINE to a bit mask of addresses that
+// should not respond.
+static constexpr auto OFFLINE_ENV = "TSC_TMC_OFFLINE";
+static constexpr uint8_t DRIVERS = 3;
+static constexpr uint8_t IFCNT = 0x02, IOIN = 0x06, IHOLD_IRUN = 0x10,
+                         TSTEP = 0x12, DRV_STATUS = 0x6F;
+
+static uint32_t registers[DRIVERS][0x80];
+static uint8_t datagram[8];
+static size_t received = 0;
+
+static uint8_t crc(const uint8_t *data, size_t len) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t byte = data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      if ((sum >> 7) ^ (byte & 0x01))
+        sum = (sum << 1) ^ 0x07;
+      else
+        sum = sum << 1;
+      byte >>= 1;
+    }
+  }
+  return sum;
+}
+
+static bool offline(uint8_t addr) {
+  const char *mask = getenv(OFFLINE_ENV);
+  return mask && (strtoul(mask, nullptr, 0) >> addr) & 1;
+}
+
+// Handles one complete datagram, returns the length of the reply
+static size_t handle(uint8_t *out) {
+  const uint8_t addr = datagram[1], reg = datagram[2] & 0x7F;
+  const bool write = datagram[2] & 0x80;
+  const size_t len = write ? 8 : 4;
+  if (addr >= DRIVERS || offline(addr) ||
+      crc(datagram, len - 1) != datagram[len - 1])
+    return 0;
+  auto &regs = registers[addr];
+  if (write) {
+    regs[reg] = static_cast<uint32_t>(datagram[3]) << 24 |
+                static_cast<uint32_t>(datagram[4]) << 16 |
+                static_cast<uint32_t>(datagram[5]) << 8 | datagram[6];
+    regs[IFCNT] = (regs[IFCNT] + 1) & 0xFF;
+    return 0;
+  }
+  uint32_t value = regs[reg];
+  if (reg == IOIN)
+    value = 0x21UL << 24;
+  else if (reg == TSTEP)
+    value = 0xFFFFF;
+  else if (reg == DRV_STATUS) // stst, cs_actual = irun
+    value = 1UL << 31 | (regs[IHOLD_IRUN] >> 8 & 0x1F) << 16;
+  const uint8_t reply[7] = {0x05,
+                            0xFF,
+                            reg,
+                            static_cast<uint8_t>(value >> 24),
+                            static_cast<uint8_t>(value >> 16),
+                            static_cast<uint8_t>(value >> 8),
+                            static_cast<uint8_t>(value)};
+  memcpy(out, reply, sizeof(reply));
+  out[sizeof(reply)] = crc(reply, sizeof(reply));
+  return sizeof(reply) + 1;
+}
+
+size_t fake_tmc2209(const uint8_t *data, size_t size, uint8_t *out,
+                    size_t space) {
+  size_t produced = 0;
+  for (size_t i = 0; i < size; i++) {
+    const uint8_t byte = data[i];
+    if (produced < space)
+      out[produced++] = byte; // Echo
+    if (received == 0 && byte != 0x05)
+      continue;
+    datagram[received++] = byte;
+    const bool write = received >= 3 && (datagram[2] & 0x80);
+    if (received < (write ? 8u : 4u))
+      continue;
+    received = 0;
+    uint8_t reply[8];
+    const size_t len = handle(reply);
+    if (produced + len <= space) {
+      memcpy(out + produced, reply, len);
+      produced += len;
+    }
+  }
+  return produced;
+}
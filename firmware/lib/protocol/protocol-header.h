@@ -35,10 +35,35 @@ typedef enum Property : uint8_t {
   MOT_ENA = 0x2,
   MOT_CFG = 0x3,
   MOT_MOV = 0x4,
-  BARRIER = 0xE, // Reserved for multi-axis synchronization
+  MOT_HOME = 0x5, // Sensorless homing against a StallGuard stall
+  MOT_STAT = 0x6, // Motor status snapshots and streams, led by a StatusKind
+  MOT_RMP = 0x7,
+  MOT_QUE = 0x8,
+  SYS_STAT = 0x9, // Timing statistics, payload led by a StatKind
+  MOT_PROG = 0xA, // Motion program, payload led by a ProgramAction
+  SYS_CFG = 0xD, // System configuration, payload led by a ConfigKey
+  BARRIER = 0xE, // Multi-axis synchronization
   FW_INFO = 0xF,
 } Property;
 
+// Frame integrity check, negotiated by the host through SYS_CFG
+typedef enum Integrity : uint8_t {
+  // Header checksum byte is the XOR of all other bytes (default)
+  XOR = 0x00,
+  // Header checksum byte is zero, frame is followed by the CRC-16/X-25 of
+  // all preceding bytes (little endian), 2 bytes more per frame than XOR
+  CRC16 = 0x01,
+} Integrity;
+
+// Framing below the protocol, negotiated by the host through SYS_CFG
+typedef enum Transport : uint8_t {
+  // One frame per COBS packet, lost frames are up to the host (default)
+  TRANSPORT_RAW = 0x00,
+  // One STCP segment per COBS packet, frames are delivered in order exactly
+  // once (see lib/stcp)
+  TRANSPORT_STCP = 0x01,
+} Transport;
+
 } // namespace Protocol
 
 #define CASE(K)                                                                \
@@ -69,6 +94,13 @@ template <> inline const char *const convert(const Protocol::Property &value) {
     CASE(MOT_ENA);
     CASE(MOT_CFG);
     CASE(MOT_MOV);
+    CASE(MOT_HOME);
+    CASE(MOT_STAT);
+    CASE(MOT_RMP);
+    CASE(MOT_QUE);
+    CASE(SYS_STAT);
+    CASE(MOT_PROG);
+    CASE(SYS_CFG);
     CASE(BARRIER);
     CASE(FW_INFO);
   default:
@@ -5,6 +5,8 @@
 #pragma once
 #include <cstdint>
 
+#include "protocol-header.h"
+
 #define __packed__ struct __attribute__((packed))
 #define PACKET(NAME, DATA) typedef __packed__ NAME DATA NAME
 
@@ -12,12 +14,43 @@
 typedef uint8_t MotorID;
 typedef int32_t Steps;     // Range -2147483648 to 2147483647
 typedef uint32_t Interval; // Range 0-4294967295us (~4294s)
+typedef uint32_t Rate;     // Step rate in steps/s
+typedef uint32_t Accel;    // Step acceleration in steps/s^2
+typedef uint32_t Jerk;     // Step jerk in steps/s^3
 
 namespace Protocol {
 
 typedef bool SystemEnable;
 static_assert(sizeof(SystemEnable) == 1, "SystemEnable must be 1 byte");
 
+// System configuration (SYS_CFG), GET carries the key only, SET and ACK
+// carry the key followed by its value.
+typedef enum : uint8_t {
+  CFG_CHECKSUM = 0x01,  // Integrity, ACK is sent in the previous mode
+  CFG_LOG_LEVEL = 0x02, // Debug log verbosity, 0 (silent) to 4 (verbose)
+  CFG_ENDSTOP = 0x03,   // Limit switch mapping, GET carries the switch index
+  CFG_STALL = 0x04,     // Stall detection on moves, GET carries the motor id
+  CFG_TRANSPORT = 0x05, // Transport, ACK is sent in the previous mode
+} ConfigKey;
+
+PACKET(ConfigHeader, { ConfigKey key; });
+
+PACKET(ConfigChecksum, {
+  ConfigKey key;
+  Integrity mode;
+});
+
+// STCP stays on until the host disconnects, the ACK is the last raw frame
+PACKET(ConfigTransport, {
+  ConfigKey key;
+  Transport mode;
+});
+
+PACKET(ConfigLogLevel, {
+  ConfigKey key;
+  uint8_t level;
+});
+
 PACKET(MotorHeader, { MotorID id; });
 
 typedef enum : uint8_t {
@@ -25,6 +58,42 @@ typedef enum : uint8_t {
   DIR_BACKWARD = 0b10,
 } Direction;
 
+PACKET(ConfigSwitch, {
+  ConfigKey key;
+  uint8_t index; // Switch index
+});
+
+// While the switch is active, steps of the motor in any of the given
+// directions are suppressed, and its pending commands are rejected.
+PACKET(ConfigEndstop, {
+  ConfigKey key;
+  uint8_t index;      // Switch index
+  MotorID id;         // Motor stopped by the switch
+  uint8_t directions; // Direction mask, 0 = not mapped
+  bool invert;        // Active low (normally closed switch)
+});
+
+// SYN SYS_CFG event sent when a mapped switch changes state
+PACKET(EndstopEvent, {
+  ConfigKey key;  // Always CFG_ENDSTOP
+  uint8_t index;  // Switch index
+  MotorID id;     // Motor stopped by the switch
+  bool active;    // Switch state after the change
+  Steps position; // Motor position when the switch changed
+});
+
+PACKET(ConfigMotor, {
+  ConfigKey key;
+  MotorID id;
+});
+
+// A StallGuard stall (DIAG pulse) during a move aborts the queue of the motor
+PACKET(ConfigStall, {
+  ConfigKey key;
+  MotorID id;
+  bool abort; // Off by default
+});
+
 PACKET(MotorEnable, {
   MotorID id;
   bool enable; // Enable or disable
@@ -46,6 +115,290 @@ PACKET(MotorMove, {
   Interval interval; // Step intervals in us
 });
 
+// SET MOT_MOV payload led by MOVE_PACKED (never a MotorID) instead of a
+// MotorMove carries packed moves. Every move is a tag byte, then the change
+// of steps and interval against the previous move of the same motor in this
+// frame (the first one against zero), as zigzag LEB128 varints unless the
+// tag marks them unchanged. Frames are self contained, a lost or rejected
+// frame never throws off the next one. Acknowledged like plain moves.
+constexpr uint8_t MOVE_PACKED = 0xFF;
+typedef enum : uint8_t {
+  PACKED_ID = 0x03,            // Motor id
+  PACKED_SAME_STEPS = 0x04,    // No steps varint, same as the previous move
+  PACKED_SAME_INTERVAL = 0x08, // No interval varint, same as the previous move
+  PACKED_RESERVED = 0xF0,      // Must be zero
+} PackedTag;
+
+// Runs toward a stall (StallGuard pulse on DIAG) for at most `travel` steps,
+// then backs off and zeroes the position. Queued like a move, acknowledged
+// once the position is zeroed, or rejected (HALT_HOMING_FAILED) if the travel
+// runs out without a stall. Needs a nonzero stall_sensitivity.
+PACKET(MotorHome, {
+  MotorID id;
+  Steps travel;      // Signed, gives the direction to home in
+  Interval interval; // Step interval in us, both ways
+  Steps backoff;     // Steps to back off the stall, >= 0
+});
+
+// Leads a MotorRange, never the first byte of UTF-8 text, so a range frame is
+// told apart from a plain text REJ MOT_MOV (validation failures).
+constexpr uint8_t MOTOR_RANGE = 0xFE;
+
+// Cumulative acknowledgement (ACK) or rejection (REJ, followed by a
+// MotorHalt) of queued motor commands. The frame carries the sequence of the
+// last command covered, and covers every command of that motor queued up to
+// and including it. Count is the number of sequences covered since the
+// previous frame of the same kind, for consistency checks on the host.
+//
+// A MOT_MOV frame with moves for several motors is still answered once: the
+// ACK carrying its sequence is sent by whichever motor picks up its last part
+// last, and ends that range. Parts on the other motors are covered silently
+// (not counted) by that motor's later ranges. If any part is rejected, the
+// first REJ covering it rejects the whole frame and no ACK follows. Hosts
+// settle such a frame on an ACK with its own sequence, or on any REJ.
+PACKET(MotorRange, {
+  uint8_t tag; // Always MOTOR_RANGE
+  MotorID id;
+  uint16_t count;
+  uint16_t queued;  // Commands still pending on this motor
+  uint16_t credits; // Free command slots, shared by all motors
+});
+
+// Why the queue of a motor was dropped
+typedef enum : uint8_t {
+  HALT_ENDSTOP = 0x01,       // Moving into an active endstop
+  HALT_STALL = 0x02,         // StallGuard stall while stall abort is on
+  HALT_HOMING_FAILED = 0x03, // HOME travel ran out without a stall
+  HALT_STOPPED = 0x04,       // Stopped by the program it belonged to
+  HALT_DISABLED = 0x05,      // Motor disabled
+} HaltReason;
+
+// Follows the MotorRange of a REJ. A stall is always reported, if need be by
+// a REJ that covers no command (count 0, sequence 0).
+PACKET(MotorHalt, {
+  HaltReason reason;
+  Steps position; // Where the motor stopped
+});
+
+// Pending queue status, also sent as SYN event when a watermark is crossed.
+// Commands of all motors are held in one shared pool: `credits` and
+// `capacity` are the same for every motor, only `queued` is per motor.
+PACKET(MotorQueue, {
+  MotorID id;
+  uint16_t queued;   // Commands still pending on this motor
+  uint16_t credits;  // Free command slots, shared by all motors
+  uint16_t capacity; // Total command slots, shared by all motors
+  __packed__ Watermark {
+    uint16_t low;  // SYN once fewer commands are queued, 0 = disabled
+    uint16_t high; // SYN once more commands are queued, capacity = disabled
+  }
+  watermark;
+});
+
+PACKET(MotorWatermark, {
+  MotorID id;
+  MotorQueue::Watermark watermark;
+});
+
+PACKET(MotorRamp, {
+  MotorID id;
+  Steps steps; // Step count
+  __packed__ Profile {
+    Rate start;  // Step rate when the ramp begins
+    Rate end;    // Step rate to approach, held once reached
+    Accel accel; // Maximum acceleration, 0 = constant rate
+    Jerk jerk;   // Jerk limit, 0 = constant acceleration (trapezoidal)
+  }
+  profile;
+});
+
+// Coordinated move of all motors, indexed by MotorID. Every enabled motor
+// waits at a barrier before the segment starts, then steps are distributed
+// over the shared duration so that all axes finish on the same tick.
+// Rejected unless the duration leaves every axis a few us per step.
+PACKET(Segment, {
+  Steps steps[3];    // Step count per motor
+  Interval duration; // Segment duration in us
+});
+
+// Motor status (MOT_STAT), GET replies with a snapshot of the given kind,
+// SET configures a periodic SYN stream of it (ACK echoes the request).
+typedef enum : uint8_t {
+  STATUS_POSITION = 0x01, // MotorPosition
+  STATUS_DRIVER = 0x02,   // DriverStatus
+} StatusKind;
+
+PACKET(StatusHeader, { StatusKind kind; });
+
+PACKET(StatusStream, {
+  StatusKind kind;
+  uint16_t period; // ms between SYN frames, 0 = off
+});
+
+// Absolute position and velocity of all motors, indexed by MotorID
+PACKET(MotorPosition, {
+  StatusKind kind;
+  uint32_t time; // Scheduler time of the snapshot, us (wraps around)
+  __packed__ Axis {
+    Steps position;   // Step edges since power on, signed by direction
+    int32_t velocity; // Current step rate in steps/s, 0 when not stepping
+  }
+  axes[3];
+});
+
+// TMC2209 health of all motors, indexed by MotorID. Registers are read in
+// the background: GET replies with the latest values, the stream requests a
+// round of reads every period and sends the snapshot once it completed.
+PACKET(DriverStatus, {
+  StatusKind kind;
+  uint32_t time;  // Scheduler time of the snapshot, us (wraps around)
+  uint8_t online; // Bit mask of MotorID with a live link, others are stale
+  __packed__ Driver {
+    uint32_t drv_status; // DRV_STATUS: temperature / short / open load flags,
+                         // CS_ACTUAL, stealth and standstill
+    uint16_t sg_result;  // SG_RESULT: StallGuard load, lower is more load
+    uint32_t tstep;      // TSTEP: measured step period, 1/fCLK units
+  }
+  drivers[3];
+});
+
+// Motion program (MOT_PROG). Instructions run in order from the entry point,
+// motion is queued like the equivalent host commands (without ACKs) and
+// control flow is resolved ahead of the step queues, so a running program
+// needs no traffic from the host.
+typedef enum : uint8_t {
+  OP_HALT = 0x00,    // End of program
+  OP_JUMP = 0x01,    // Continue at target
+  OP_LOOP = 0x02,    // Jump back to target until the body ran count times
+  OP_DELAY = 0x03,   // All enabled motors hold still for delay us, in sync
+  OP_MOVE = 0x04,    // Same as MOT_MOV
+  OP_SEGMENT = 0x05, // Same as BARRIER with a segment
+  OP_SYNC = 0x06,    // Same as BARRIER without a segment
+} Opcode;
+
+PACKET(Instruction, {
+  Opcode op;
+  union __attribute__((packed)) {
+    __packed__ {
+      uint16_t target; // Instruction index
+      uint16_t count;  // LOOP only, 0 = forever
+    }
+    jump;             // JUMP, LOOP
+    Interval delay;   // DELAY
+    MotorMove move;   // MOVE
+    Segment segment;  // SEGMENT
+  };
+});
+
+typedef enum : uint8_t {
+  PROG_LOAD = 0x01,  // Write instructions, not while running
+  PROG_RUN = 0x02,   // Start from an entry point
+  PROG_STOP = 0x03,  // Stop, and halt the motion of the program still queued
+  PROG_STORE = 0x04, // Write instructions into a storage slot, not in motion
+  PROG_PLAY = 0x05,  // Run a stored program, streamed from flash
+  PROG_ERASE = 0x06, // Empty a storage slot, not in motion
+} ProgramAction;
+
+// Storage slots for programs, kept in the spiffs partition
+constexpr uint8_t PROGRAM_SLOTS = 64;
+// Source of a program run from RAM (PROG_LOAD / PROG_RUN)
+constexpr uint8_t PROGRAM_RAM = 0xFF;
+
+PACKET(ProgramHeader, { ProgramAction action; });
+
+// Followed by the instructions. Writing at offset 0 starts a new program,
+// later chunks must continue where the previous one ended.
+PACKET(ProgramLoad, {
+  ProgramAction action;
+  uint16_t offset;
+});
+
+PACKET(ProgramRun, {
+  ProgramAction action;
+  uint16_t entry;
+});
+
+// Same as ProgramLoad, into a storage slot
+PACKET(ProgramStore, {
+  ProgramAction action;
+  uint8_t slot;
+  uint16_t offset;
+});
+
+PACKET(ProgramPlay, {
+  ProgramAction action;
+  uint8_t slot;
+  uint16_t entry;
+});
+
+PACKET(ProgramSlot, {
+  ProgramAction action;
+  uint8_t slot;
+});
+
+// Replied to GET without payload and every SET
+PACKET(ProgramStatus, {
+  bool running;      // Still issuing motion
+  uint8_t source;    // Storage slot of the program, or PROGRAM_RAM
+  uint16_t pc;       // Next instruction to issue
+  uint16_t size;     // Instructions in the source
+  uint16_t capacity; // Instructions that fit in RAM
+  uint32_t issued;   // Motion commands queued since the program started
+});
+
+// Why a program ended
+typedef enum : uint8_t {
+  END_HALT = 0x01,            // HALT, or past the last instruction
+  END_STOPPED = 0x02,         // PROG_STOP
+  END_DISCONNECTED = 0x03,    // Host disconnected
+  END_MOTOR_HALTED = 0x04,    // A motor it drives was halted (see MotorHalt)
+  END_MOTOR_DISABLED = 0x05,  // A motor it drives is disabled
+  END_READ_ERROR = 0x06,      // Stored program could not be read
+  END_BAD_INSTRUCTION = 0x07, // Invalid instruction in a stored program
+  END_BAD_TARGET = 0x08,      // Jump target past the end of the program
+  END_TOO_DEEP = 0x09,        // Loops nested too deep
+} ProgramEnd;
+
+// SYN MOT_PROG event sent when a program ends, pc is the next instruction
+// it would have issued
+PACKET(ProgramEvent, {
+  ProgramStatus status;
+  ProgramEnd reason;
+});
+
+// Replied to GET with PROG_STORE
+PACKET(ProgramDirectory, {
+  ProgramAction action;
+  uint32_t total; // Bytes in the partition, 0 = no storage
+  uint32_t used;  // Bytes in use
+  uint16_t sizes[PROGRAM_SLOTS]; // Instructions per slot, 0 = empty
+});
+
+// Timing statistics (SYS_STAT), GET reads a histogram, SET reads and resets
+// it. The motor id is only meaningful for per-motor statistics.
+typedef enum : uint8_t {
+  STAT_ISR_TIME = 0x01,   // Duration of each ISR invocation, CPU cycles
+  STAT_ISR_PERIOD = 0x02, // Time between ISR invocations while busy, us
+  STAT_LATENESS = 0x03,   // Step edge time past its schedule, per motor, us
+} StatKind;
+
+PACKET(StatHeader, {
+  StatKind kind;
+  MotorID id;
+});
+
+PACKET(Histogram, {
+  StatKind kind;
+  MotorID id;
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum; // mean = sum / count
+  // Log2 buckets: [0] counts zeros, [i] counts 2^(i-1) .. 2^i - 1, the last
+  // bucket also counts everything above.
+  uint32_t buckets[16];
+});
+
 }; // namespace Protocol
 
 #undef PACKET
\ No newline at end of file
@@ -8,70 +8,154 @@
 
 namespace Protocol {
 
-RX::RX(bool (*available)(), char (*read)()) : available(available), read(read) {
+RX::RX(size_t (*read)(void *buf, size_t size)) : read(read) {
   cobs.reset();
   frame.reset();
 }
 
-void RX::recv() {
-  if (valid)
-    return;
-  const auto ret = cobs.decode(available, read);
-  if (ret == COBS::UNFINISHED)
-    return;
-  if (ret > 0) {
-    if (ret >= static_cast<int>(sizeof(frame.header))) {
-      frame.payload_size = ret - sizeof(frame.header);
-      memcpy(&frame.buffer, cobs.data, ret);
-      valid = frame.validate();
-      if (!valid) {
-        DEBUG("❌ RX Packet CRC check failed\n  Raw [");
-        for (uint8_t i = 0; i < cobs.raw_index; i++) {
-          DEBUG(" %02X", cobs.raw[i]);
-        }
-        DEBUG(" ]\n  Dec [");
-        for (uint8_t i = 0; i < ret; i++) {
-          DEBUG(" %02X", ((uint8_t *)&frame.buffer)[i]);
-        }
-        DEBUG(" ]\n");
+bool RX::recv(bool deliver) {
+  if (!deliver && !transport)
+    return false;
+  while (true) {
+    if (transport && deliver) {
+      const int len = transport->deliver(frame.buffer);
+      if (len >= 0) {
+        if (frame.accept(len, integrity))
+          return true;
+        DEBUG_ERROR("❌ RX Packet CRC check failed\n");
+        Debug::dump(Debug::ERROR, "  Dec", frame.buffer, len);
+        continue;
       }
-    } else {
-      DEBUG("📦 RX Packet too short: %d bytes\n", ret);
     }
-  } else {
-    DEBUG("⚠️ RX COBS decode error %d: %s\n  Raw [", ret, COBS::errorno(ret));
-    for (uint8_t i = 0; i < cobs.raw_index; i++) {
-      DEBUG(" %02X", cobs.raw[i]);
+    if (head == tail) {
+      const auto len = read(chunk, sizeof(chunk));
+      if (len == 0)
+        return false;
+      head = chunk;
+      tail = chunk + len;
+    }
+    const auto begin = head;
+    const auto ret = cobs.decode(head, tail, transport ? segment : frame.buffer);
+    if (ret == COBS::UNFINISHED)
+      continue;
+    cobs.reset();
+    if (ret > 0 && transport) {
+      // Delivered on the next iteration if it is in order
+      if (!transport->input(segment, ret)) {
+        DEBUG_ERROR("❌ RX STCP segment check failed\n");
+        Debug::dump(Debug::ERROR, "  Raw", begin, head - begin);
+      }
+    } else if (ret > 0) {
+      if (ret >= static_cast<int>(sizeof(frame.header) +
+                                  Frame::trailer(integrity))) {
+        if (frame.accept(ret, integrity))
+          return true;
+        // Raw bytes of the current frame are only available from this chunk
+        DEBUG_ERROR("❌ RX Packet CRC check failed\n");
+        Debug::dump(Debug::ERROR, "  Raw", begin, head - begin);
+        Debug::dump(Debug::ERROR, "  Dec", frame.buffer, ret);
+      } else {
+        DEBUG_WARN("📦 RX Packet too short: %d bytes\n", ret);
+      }
+    } else {
+      DEBUG_ERROR("⚠️ RX COBS decode error %d: %s\n", ret, COBS::errorno(ret));
+      Debug::dump(Debug::ERROR, "  Raw", begin, head - begin);
     }
-    DEBUG(" ]\n");
   }
-  cobs.reset();
 }
 
 void RX::reset() {
-  valid = false;
+  head = tail = chunk;
   cobs.reset();
   frame.reset();
 }
 
-TX::TX(size_t (*write)(const void *buf, size_t size)) : write(write) {
-  cobs.reset();
-  frame.reset();
-}
+TX::TX(size_t (*write)(const void *buf, size_t size)) : write(write) {}
 
-int TX::write_frame(Sequence s, Method m, Property p, const void *payload,
-                    size_t size) {
-  if (size > sizeof(frame.payload))
-    size = sizeof(frame.payload);
+size_t TX::enqueue(Sequence s, Method m, Property p, const void *payload,
+                   size_t size) {
+  // Encode outside of the critical section
+  Frame frame;
+  COBS::TX cobs;
+  const Integrity mode = integrity;
+  STCP::Port *const port = transport;
+  const size_t limit = sizeof(frame.payload) - Frame::trailer(mode) -
+                       (port ? STCP::OVERHEAD : 0);
+  if (size > limit)
+    size = limit;
   frame.header.set(s, m, p);
-  memcpy(&frame.payload, payload, size);
+  if (size)
+    memcpy(&frame.payload, payload, size);
   frame.payload_size = size;
-  return size;
+  const uint8_t len = frame.seal(mode);
+  if (port) {
+    if (port->send(frame.buffer, len, s ? 0 : RESERVE))
+      return len;
+    dropped++;
+    return 0;
+  }
+  cobs.encode(frame.buffer, len);
+  const size_t keep = s ? 0 : RESERVE * COBS_MAX_ENCODED;
+  if (!append(cobs.payload(), cobs.size(), keep)) {
+    dropped++;
+    return 0;
+  }
+  return cobs.size();
+}
+
+bool TX::append(const uint8_t *data, size_t len, size_t keep) {
+  portENTER_CRITICAL(&lock);
+  const bool fits = queue.space() >= len + keep;
+  if (fits)
+    queue.write(data, len);
+  portEXIT_CRITICAL(&lock);
+  return fits;
 }
 
-int TX::encode_frame() {
-  frame.checksum();
-  return cobs.encode((uint8_t *)&frame.buffer, frame.size());
+size_t TX::flush() {
+  // Segments due on the STCP port are encoded as long as the queue has room
+  // for any of them, so that none is taken out only to be lost
+  if (STCP::Port *const port = transport) {
+    uint8_t segment[STCP::MAX_SEGMENT];
+    while (true) {
+      portENTER_CRITICAL(&lock);
+      const size_t space = queue.space();
+      portEXIT_CRITICAL(&lock);
+      if (space < COBS_MAX_ENCODED)
+        break;
+      const uint8_t len = port->next(segment);
+      if (len == 0)
+        break;
+      COBS::TX cobs;
+      cobs.encode(segment, len);
+      append(cobs.payload(), cobs.size());
+    }
+  }
+  // At most two contiguous runs, frames enqueued meanwhile wait for the next
+  // flush
+  size_t total = 0;
+  for (int i = 0; i < 2; i++) {
+    const auto span = queue.peek_span();
+    if (span.size == 0)
+      break;
+    const size_t len = write(span.data, span.size);
+    queue.pop(len);
+    total += len;
+    if (len < span.size)
+      break; // Port is full, retry on next flush
+  }
+  return total;
+}
+
+void TX::reset() { queue.pop(queue.len()); }
+
+bool TX::ready() {
+  if (STCP::Port *const port = transport)
+    return port->space() >= RESERVE;
+  portENTER_CRITICAL(&lock);
+  const bool room = queue.space() >= RESERVE * COBS_MAX_ENCODED;
+  portEXIT_CRITICAL(&lock);
+  return room;
 }
 
 } // namespace Protocol
@@ -9,7 +9,11 @@
 #include <cstring>
 #include <stdint.h>
 
+#include "crc.h"
+#include "freertos/FreeRTOS.h"
 #include "protocol-header.h"
+#include "ring-buffer.h"
+#include "stcp.h"
 
 namespace Protocol {
 
@@ -62,6 +66,34 @@ public:
   inline bool validate() const {
     return header.checksum == header.compute_checksum(payload, payload_size);
   }
+  // Bytes reserved after the payload by the integrity check
+  static constexpr uint8_t trailer(Integrity mode) {
+    return mode == CRC16 ? sizeof(uint16_t) : 0;
+  }
+  // Fill in the integrity check, returns the number of bytes to transmit
+  inline uint8_t seal(Integrity mode) {
+    if (mode != CRC16) {
+      checksum();
+      return size();
+    }
+    header.checksum = 0;
+    const uint8_t len = size();
+    const uint16_t crc = CRC::crc16(buffer, len);
+    buffer[len] = crc & 0xFF;
+    buffer[len + 1] = crc >> 8;
+    return len + trailer(mode);
+  }
+  // Check a received frame of `len` decoded bytes, sets payload_size
+  inline bool accept(uint8_t len, Integrity mode) {
+    if (len < sizeof(header) + trailer(mode))
+      return false;
+    payload_size = len - sizeof(header) - trailer(mode);
+    if (mode != CRC16)
+      return validate();
+    const uint8_t end = len - trailer(mode);
+    const uint16_t crc = buffer[end] | buffer[end + 1] << 8;
+    return header.checksum == 0 && crc == CRC::crc16(buffer, end);
+  }
   template <typename T>
   constexpr inline const bool check(size_t size = sizeof(T)) const {
     return size == payload_size;
@@ -78,58 +110,84 @@ static_assert(sizeof(Frame) == COBS_MAX_CONTENT + sizeof(Frame::payload_size),
               "Size of Frame should equal COBS_MAX_CONTENT");
 
 class RX {
-  bool (*const available)();
-  char (*const read)();
+  // Non-blocking bulk read, returns the number of bytes read (maybe 0)
+  size_t (*const read)(void *buf, size_t size);
+  // Raw input, frames are decoded from here directly into `frame`
+  uint8_t chunk[512];
+  const uint8_t *head = chunk, *tail = chunk;
+  // Decoded STCP segment, frames reach `frame` once they are in order
+  uint8_t segment[STCP::MAX_SEGMENT];
 
 public:
   COBS::RX cobs;
   Frame frame;
-  bool valid = false;
-  RX(bool (*available)(), char (*read)());
-  void recv();
+  Integrity integrity = XOR;
+  // Frames arrive through this STCP port if set, raw otherwise
+  STCP::Port *transport = nullptr;
+  RX(size_t (*read)(void *buf, size_t size));
+  // Decode the next frame, returns true if a valid frame is ready in `frame`.
+  // The frame stays valid until the next call, so that it can be processed
+  // in place. Without `deliver` no frame is handed out: raw input is left
+  // unread, STCP segments are still taken in (so that acknowledgements are
+  // processed) but held back.
+  bool recv(bool deliver = true);
   void reset();
 };
 
 #define ARGS Sequence s, Method m, Property p
 
+// Outbound frames are encoded by the producer and appended to a byte queue,
+// which is drained by a single writer (flush). Producers never block.
+// Unsolicited frames (sequence 0, i.e. SYN events and streams) are dropped if
+// they would cut into the room reserved for replies. Replies are not dropped
+// as long as requests are only taken in while the queue is ready().
 class TX {
+  // Producers take turns under the lock, the writer needs none
+  RingBuffer<uint8_t, 4096> queue;
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  // Append encoded bytes, false if they do not fit with `keep` bytes to spare
+  bool append(const uint8_t *data, size_t len, size_t keep = 0);
+
 public:
+  // Worst-case frames (STCP backlog entries) kept free for replies, a single
+  // request may produce several of them (e.g. disabling the system reports
+  // on every motor)
+  static constexpr size_t RESERVE = 8;
+  // Non-blocking write, returns the number of bytes accepted (maybe 0)
   size_t (*const write)(const void *buf, size_t size);
-  COBS::TX cobs;
-  Frame frame;
+  // Number of frames dropped due to a full queue
+  unsigned dropped = 0;
+  // Applied when a frame is enqueued
+  Integrity integrity = XOR;
+  // Frames are handed to this STCP port if set, which keeps them until they
+  // are acknowledged. They reach the byte queue on flush, as the window
+  // allows.
+  STCP::Port *transport = nullptr;
   TX(size_t (*write)(const void *buf, size_t size));
 
-  template <typename T> inline void write_frame(ARGS, const T payload) {
-    write_frame(s, m, p, &payload, sizeof(T));
-  }
-
-  template <typename T> inline void write_frame(ARGS, const T *payload) {
-    write_frame(s, m, p, payload, sizeof(T));
-  }
-
-  int write_frame(ARGS, const void *payload, size_t size);
-  int encode_frame();
-
-  inline size_t send_frame() { return write(cobs.payload(), cobs.size()); }
+  // Encode and enqueue one frame, returns the encoded size (0 if dropped).
+  // Payloads are truncated to what fits along with the integrity check and
+  // the STCP overhead.
+  size_t enqueue(ARGS, const void *payload, size_t size);
+  // Write out as much of the queue as the port accepts, in at most two
+  // contiguous writes. Returns the number of bytes written.
+  size_t flush();
+  // Drop all queued frames (e.g. host disconnected)
+  void reset();
+  // Whether RESERVE worst-case frames still fit (into the STCP backlog if a
+  // port is set), i.e. whether another request may be taken in without
+  // risking its replies
+  bool ready();
 
-  inline size_t send(ARGS) {
-    frame.header.set(s, m, p);
-    frame.payload_size = 0; // No payload
-    encode_frame();
-    return send_frame();
-  }
+  inline size_t send(ARGS) { return enqueue(s, m, p, nullptr, 0); }
 
   template <typename T> inline size_t send(ARGS, const T &payload) {
-    write_frame(s, m, p, &payload, sizeof(T));
-    encode_frame();
-    return send_frame();
+    return enqueue(s, m, p, &payload, sizeof(T));
   }
 
   template <typename T>
   inline size_t send(ARGS, const T *payload, uint8_t count) {
-    write_frame(s, m, p, payload, sizeof(T) * count);
-    encode_frame();
-    return send_frame();
+    return enqueue(s, m, p, payload, sizeof(T) * count);
   }
 
   inline size_t print(ARGS, const char *payload) {
@@ -0,0 +1,181 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+
+#include "stcp.h"
+#include "crc.h"
+
+#include <cstring>
+
+namespace STCP {
+
+static inline uint8_t seal(uint8_t *segment, uint8_t size) {
+  const uint16_t crc = CRC::crc16(segment, size);
+  segment[size] = crc & 0xFF;
+  segment[size + 1] = crc >> 8;
+  return size + sizeof(crc);
+}
+
+bool Port::send(const uint8_t *body, uint8_t size, uint8_t keep) {
+  if (size > MAX_PAYLOAD)
+    return false;
+  portENTER_CRITICAL(&lock);
+  if (static_cast<uint8_t>(head - base) + keep >= BACKLOG) {
+    dropped++;
+    portEXIT_CRITICAL(&lock);
+    return false;
+  }
+  auto &o = out[head % BACKLOG];
+  const auto header = reinterpret_cast<Header *>(o.data);
+  header->type = STCP_DATA;
+  header->sequence = head;
+  header->sack = 0;
+  memcpy(header->payload, body, size);
+  o.size = seal(o.data, sizeof(Header) + size);
+  o.acked = o.lost = false;
+  head++;
+  portEXIT_CRITICAL(&lock);
+  return true;
+}
+
+uint8_t Port::space() {
+  portENTER_CRITICAL(&lock);
+  const uint8_t used = head - base;
+  portEXIT_CRITICAL(&lock);
+  return BACKLOG - used;
+}
+
+uint8_t Port::next(uint8_t *segment) {
+  const uint32_t now = clock();
+  portENTER_CRITICAL(&lock);
+  if (ack_due) {
+    ack_due = false;
+    const auto header = reinterpret_cast<Header *>(segment);
+    header->type = STCP_ACK;
+    header->sequence = expected;
+    header->sack = 0;
+    for (uint8_t i = 1; i < WINDOW; i++)
+      if (in[(expected + i) % WINDOW].full)
+        header->sack |= 1 << (i - 1);
+    portEXIT_CRITICAL(&lock);
+    return seal(segment, sizeof(Header));
+  }
+  // Holes reported by the receiver go first, then timeouts, then new data
+  Outbound *due = nullptr;
+  for (uint8_t s = base; s != fresh && !due; s++) {
+    auto &o = out[s % BACKLOG];
+    if (!o.acked && o.lost)
+      due = &o;
+  }
+  for (uint8_t s = base; s != fresh && !due; s++) {
+    auto &o = out[s % BACKLOG];
+    if (!o.acked && now - o.sent >= RTO)
+      due = &o;
+  }
+  if (due) {
+    retransmitted++;
+  } else if (fresh != head && static_cast<uint8_t>(fresh - base) < WINDOW) {
+    due = &out[fresh % BACKLOG];
+    fresh++;
+  } else {
+    portEXIT_CRITICAL(&lock);
+    return 0;
+  }
+  due->lost = false;
+  due->sent = now;
+  const uint8_t size = due->size;
+  memcpy(segment, due->data, size);
+  portEXIT_CRITICAL(&lock);
+  return size;
+}
+
+// Called under lock
+void Port::acknowledged(uint8_t ack, uint8_t sack, uint32_t now) {
+  const uint8_t flight = fresh - base;
+  // Stale (reordered) or bogus ACKs would move the window backwards
+  if (static_cast<uint8_t>(ack - base) > flight)
+    return;
+  base = ack;
+  const uint8_t remaining = fresh - base;
+  uint8_t last = base;
+  for (uint8_t i = 0; i < 8; i++) {
+    const uint8_t s = ack + 1 + i;
+    if (!(sack & (1 << i)) || static_cast<uint8_t>(s - base) >= remaining)
+      continue;
+    out[s % BACKLOG].acked = true;
+    last = s;
+  }
+  // Everything below the last segment received is missing, unless it was
+  // just sent again
+  for (uint8_t s = base; s != last; s++) {
+    auto &o = out[s % BACKLOG];
+    if (!o.acked && now - o.sent >= HOLDOFF)
+      o.lost = true;
+  }
+}
+
+bool Port::input(const uint8_t *segment, uint8_t size) {
+  if (size < OVERHEAD)
+    return false;
+  const uint8_t end = size - sizeof(uint16_t);
+  const uint16_t crc = segment[end] | segment[end + 1] << 8;
+  if (crc != CRC::crc16(segment, end))
+    return false;
+  const auto header = reinterpret_cast<const Header *>(segment);
+  const uint32_t now = clock();
+  portENTER_CRITICAL(&lock);
+  switch (header->type) {
+  case STCP_DATA: {
+    // Duplicates (and segments beyond the window) are dropped, but still
+    // acknowledged in case the previous ACK was lost
+    auto &slot = in[header->sequence % WINDOW];
+    if (static_cast<uint8_t>(header->sequence - expected) < WINDOW &&
+        !slot.full) {
+      slot.size = end - sizeof(Header);
+      memcpy(slot.data, header->payload, slot.size);
+      slot.full = true;
+    } else {
+      duplicates++;
+    }
+    ack_due = true;
+    break;
+  }
+  case STCP_ACK:
+    acknowledged(header->sequence, header->sack, now);
+    break;
+  default:
+    portEXIT_CRITICAL(&lock);
+    return false;
+  }
+  portEXIT_CRITICAL(&lock);
+  return true;
+}
+
+int Port::deliver(uint8_t *body) {
+  portENTER_CRITICAL(&lock);
+  auto &slot = in[expected % WINDOW];
+  if (!slot.full) {
+    portEXIT_CRITICAL(&lock);
+    return -1;
+  }
+  const uint8_t size = slot.size;
+  memcpy(body, slot.data, size);
+  slot.full = false;
+  expected++;
+  portEXIT_CRITICAL(&lock);
+  return size;
+}
+
+void Port::reset() {
+  portENTER_CRITICAL(&lock);
+  base = fresh = head = 0;
+  expected = 0;
+  ack_due = false;
+  for (auto &slot : in)
+    slot.full = false;
+  retransmitted = duplicates = dropped = 0;
+  portEXIT_CRITICAL(&lock);
+}
+
+} // namespace STCP
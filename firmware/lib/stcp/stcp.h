@@ -4,49 +4,108 @@
 // =============================================================================
 // Serial Transport Control Protocol (STCP)
 // =============================================================================
+// Sliding window transport below the Protocol layer, negotiated by the host
+// through SYS_CFG. Each COBS frame carries one segment:
+//   Header | body (one Protocol frame) | CRC-16/X-25 of all preceding bytes
+// DATA segments are numbered modulo 256 and delivered in order exactly once.
+// The receiver answers with cumulative ACKs, `sack` marks the segments held
+// beyond a gap so that the sender retransmits only the missing ones. A
+// segment that stays unacknowledged for RTO is sent again.
+// =============================================================================
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #include <cobs.h>
 
+#include "freertos/FreeRTOS.h"
+
 namespace STCP {
 
 typedef enum : uint8_t {
-  STCP_REQ = 0x00,
+  STCP_DATA = 0x00,
   STCP_ACK = 0x01,
-  STCP_REJ = 0x02,
 } PacketType;
 
 typedef struct __attribute__((packed)) Header {
-  uint8_t crc;
-  uint8_t sequence;
   PacketType type;
-  uint8_t size;
+  // DATA: segment number, ACK: next segment expected in order
+  uint8_t sequence;
+  // ACK only: bit i set if segment (sequence + 1 + i) was received
+  uint8_t sack;
   uint8_t payload[0];
 } Header;
 
-typedef union Frame {
-  Header header;
-  uint8_t buffer[256];
-} Frame;
+static_assert(sizeof(Header) == 3, "Size of STCP header should be 3 bytes");
 
-constexpr uint8_t MAX_PAYLOAD = sizeof(Frame) - sizeof(Header);
+constexpr uint8_t OVERHEAD = sizeof(Header) + sizeof(uint16_t);
+constexpr uint8_t MAX_SEGMENT = COBS_MAX_CONTENT;
+constexpr uint8_t MAX_PAYLOAD = MAX_SEGMENT - OVERHEAD;
 
-static_assert(sizeof(Header) == 4, "Size of STCP header should be 4 bytes");
+// Segments in flight, in both directions
+constexpr uint8_t WINDOW = 8;
+// Outbound segments kept until acknowledged (including the window)
+constexpr uint8_t BACKLOG = 32;
+// Retransmission timeout (ms)
+constexpr uint32_t RTO = 100;
+// Least time between two retransmissions of the same segment requested by
+// a SACK (ms), duplicate ACKs of one gap arrive in bursts
+constexpr uint32_t HOLDOFF = 20;
 
-typedef int (*Reader)(char *buf, unsigned count);
-typedef int (*Writer)(const char *buf, unsigned count);
+static_assert(BACKLOG < 128 && WINDOW <= 8, "Sequence space too small");
+
+// Both ends of one connection. Outbound bodies are queued with send() and
+// leave through next(), which also produces the ACKs; inbound segments are
+// fed to input() and come out of deliver() in order. All methods are safe to
+// call from different tasks.
+class Port {
+  struct Outbound {
+    uint8_t size;
+    bool acked;
+    bool lost;     // Reported missing by a SACK, retransmit first
+    uint32_t sent; // ms, valid once transmitted
+    uint8_t data[MAX_SEGMENT];
+  };
+  struct Inbound {
+    bool full;
+    uint8_t size;
+    uint8_t data[MAX_PAYLOAD];
+  };
+  // Sender: base = oldest unacknowledged, fresh = next never transmitted,
+  // head = next to be queued
+  Outbound out[BACKLOG];
+  uint8_t base = 0, fresh = 0, head = 0;
+  // Receiver: expected = next to be delivered
+  Inbound in[WINDOW];
+  uint8_t expected = 0;
+  bool ack_due = false;
+  portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+  void acknowledged(uint8_t ack, uint8_t sack, uint32_t now);
 
-template <unsigned SIZE = 128> class Port {
 public:
-  const Reader read;
-  const Writer write;
-  // Pending outbound frame
-  bool out_pending = false;
-  unsigned long last_retry = 0; // milliseconds
-  unsigned retry_count = 0;
-  Frame out_frame;
+  uint32_t (*const clock)(); // ms
+  // Statistics since reset()
+  unsigned retransmitted = 0, duplicates = 0, dropped = 0;
+
+  Port(uint32_t (*clock)()) : clock(clock) {}
+
+  // Queue a body for transmission, false if the backlog is full or would be
+  // left with less than `keep` free entries
+  bool send(const uint8_t *body, uint8_t size, uint8_t keep = 0);
+  // Free backlog entries, i.e. bodies send() accepts right now
+  uint8_t space();
+  // Next segment to transmit (ACK, retransmission or new data) written into
+  // `segment` (MAX_SEGMENT bytes), returns its size or 0 if nothing is due
+  uint8_t next(uint8_t *segment);
+  // Process a decoded segment, false if it is corrupted
+  bool input(const uint8_t *segment, uint8_t size);
+  // Copy the next in-order body into `body` (MAX_PAYLOAD bytes), returns its
+  // size or -1 if none is ready
+  int deliver(uint8_t *body);
+  // Start a new connection, all queued segments are discarded
+  void reset();
 };
 
 } // namespace STCP
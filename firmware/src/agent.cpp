@@ -5,12 +5,16 @@
 #include "agent.h"
 #include "board.h"
 #include "debug.h"
+#include "endstop.h"
 #include "esp32-hal.h"
 #include "esp_task_wdt.h"
 #include "global.h"
 #include "motor.h"
+#include "program.h"
 #include "protocol-impl.h"
 #include "protocol.h"
+#include "store.h"
+#include "tmc.h"
 #include "version.h"
 
 using namespace Protocol;
@@ -35,6 +39,14 @@ static constexpr auto NO_SUCH_MOTOR = "No such motor";
 static constexpr auto MOTOR_OFFLINE = "Motor Offline";
 static constexpr auto MOTOR_DISABLED = "Motor Disabled";
 static constexpr auto MOTOR_QUEUE_FULL = "Motor Queue Full";
+static constexpr auto NO_SUCH_KEY = "No such config key";
+static constexpr auto NO_SUCH_STAT = "No such statistic";
+static constexpr auto TRANSPORT_LOCKED = "Reconnect to leave STCP";
+
+// Period of the SYN MOT_STAT position stream (ms), 0 = off
+static uint16_t position_period = 0;
+// Period of the SYN MOT_STAT driver health stream (ms), 0 = off
+static uint16_t driver_period = 0;
 
 #define HANDLE_COMMAND(METHOD, PROP, PAYLOAD_TYPE, CODE)                       \
   case HEADER(METHOD, PROP): {                                                 \
@@ -56,12 +68,127 @@ static constexpr auto MOTOR_QUEUE_FULL = "Motor Queue Full";
     PRINT(REJ, PROP, NO_SUCH_MOTOR);                                           \
   }
 
+// Decodes packed moves (MOVE_PACKED) in frame order
+class PackedMoves {
+  const uint8_t *next, *const end;
+  // Previous move of each motor in this frame
+  Steps steps[3] = {0, 0, 0};
+  Interval intervals[3] = {0, 0, 0};
+
+  // Zigzag LEB128, false if truncated or wider than 32 bits
+  inline bool varint(uint32_t &delta) {
+    uint32_t raw = 0;
+    for (unsigned shift = 0; shift < 32; shift += 7) {
+      if (next == end)
+        return false;
+      const uint8_t byte = *next++;
+      if (shift == 28 && byte > 0x0F)
+        return false;
+      raw |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) {
+        delta = (raw >> 1) ^ (0U - (raw & 1));
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  explicit PackedMoves(const Frame &frame)
+      : next(frame.payload + 1), end(frame.payload + frame.payload_size) {}
+  inline bool done() const { return next == end; }
+  // Decodes the next move, false if malformed
+  bool decode(MotorID &id, Steps &step, Interval &interval) {
+    if (next == end)
+      return false;
+    const uint8_t tag = *next++;
+    id = tag & PACKED_ID;
+    if (tag & PACKED_RESERVED || id >= 3)
+      return false;
+    uint32_t delta;
+    if (!(tag & PACKED_SAME_STEPS)) {
+      if (!varint(delta))
+        return false;
+      // Wraps around like the host side
+      steps[id] = static_cast<Steps>(static_cast<uint32_t>(steps[id]) + delta);
+    }
+    if (!(tag & PACKED_SAME_INTERVAL)) {
+      if (!varint(delta))
+        return false;
+      intervals[id] += delta;
+    }
+    step = steps[id];
+    interval = intervals[id];
+    return true;
+  }
+};
+
+// Frames with moves for several motors are acknowledged once, through a
+// batch shared by the last move of each motor. Returns the handle for the
+// last moves (0 if there is a single motor), sets `error` if no batch is
+// free.
+static uint16_t openBatch(const unsigned slots[3], const char *&error) {
+  uint8_t involved = 0;
+  for (unsigned id = 0; id < 3; id++)
+    if (slots[id])
+      involved |= 1 << id;
+  if (!(involved & (involved - 1)))
+    return 0;
+  const uint16_t handle = Motor::Batch::open(involved);
+  if (!handle)
+    error = MOTOR_QUEUE_FULL;
+  return handle;
+}
+
+// Same as plain MOT_MOV: all-or-nothing, the last move of each motor carries
+// the sequence. Decoded twice, to validate and to queue, as the frame may
+// hold far more moves than fit on the stack.
+static void queuePackedMoves(const Frame &frame) {
+  const auto &seq = frame.header.sequence;
+  unsigned slots[3] = {0, 0, 0}, total = 0;
+  const char *error = nullptr;
+  MotorID id;
+  Steps steps;
+  Interval interval;
+  PackedMoves check(frame);
+  if (check.done())
+    error = BAD_PAYLOAD;
+  while (!error && !check.done()) {
+    const auto motor =
+        check.decode(id, steps, interval) ? getMotorByID(id) : nullptr;
+    if (!motor)
+      error = BAD_PAYLOAD;
+    else if (!motor->enabled)
+      error = MOTOR_DISABLED;
+    else {
+      slots[motor->addr]++;
+      // Queue slots are shared by all motors
+      if (++total > Motor::arena.space())
+        error = MOTOR_QUEUE_FULL;
+    }
+  }
+  const uint16_t batch = error ? 0 : openBatch(slots, error);
+  if (error) {
+    PRINT(REJ, MOT_MOV, error);
+    return;
+  }
+  PackedMoves moves(frame);
+  while (moves.decode(id, steps, interval)) {
+    auto &motor = *getMotorByID(id);
+    const bool last = --slots[motor.addr] == 0;
+    const uint16_t part = last ? batch : 0;
+    motor.pending.push(Motor::Command{last ? seq : Sequence(0), Motor::MOVE,
+                                      steps, {{interval, part}}});
+  }
+  Motor::Scheduler::wake();
+}
+
 inline void processFrame(const Frame &frame) {
   const auto &seq = frame.header.sequence;
   const auto &code = frame.header.code;
-  DEBUG("RX [%06d] %s::%s\n", seq,
-        convert<const char *const>(frame.header.method()),
-        convert<const char *const>(frame.header.property()));
+  DEBUG_VERBOSE("RX [%06d] %s::%s\n", seq,
+                convert<const char *const>(frame.header.method()),
+                convert<const char *const>(frame.header.property()));
   switch (code) {
   case HEADER(GET, FW_INFO):
     TRACE("GET::FW_INFO");
@@ -89,6 +216,173 @@ inline void processFrame(const Frame &frame) {
     TRACE("GET::SYS_ENA");
     REPLY(ACK, SYS_ENA, Board::Drv::is_enabled());
     break;
+    HANDLE_COMMAND(GET, SYS_CFG, Protocol::ConfigHeader, {
+      switch (cmd->key) {
+      case CFG_CHECKSUM:
+        REPLY(ACK, SYS_CFG,
+              Protocol::ConfigChecksum{
+                  .key = cmd->key,
+                  .mode = tx.integrity,
+              });
+        break;
+      case CFG_TRANSPORT:
+        REPLY(ACK, SYS_CFG,
+              Protocol::ConfigTransport{
+                  .key = cmd->key,
+                  .mode = tx.transport ? TRANSPORT_STCP : TRANSPORT_RAW,
+              });
+        break;
+      case CFG_LOG_LEVEL:
+        REPLY(ACK, SYS_CFG,
+              Protocol::ConfigLogLevel{
+                  .key = cmd->key,
+                  .level = Debug::verbosity,
+              });
+        break;
+      case CFG_ENDSTOP: {
+        const auto sw = frame.as<Protocol::ConfigSwitch>();
+        const auto cfg = sw ? Endstop::config(sw->index) : nullptr;
+        if (cfg == nullptr) {
+          PRINT(REJ, SYS_CFG, BAD_PAYLOAD);
+          break;
+        }
+        REPLY(ACK, SYS_CFG, *cfg);
+        break;
+      }
+      case CFG_STALL: {
+        const auto m = frame.as<Protocol::ConfigMotor>();
+        const auto motor = m ? getMotorByID(m->id) : nullptr;
+        if (motor == nullptr) {
+          PRINT(REJ, SYS_CFG, NO_SUCH_MOTOR);
+          break;
+        }
+        REPLY(ACK, SYS_CFG,
+              Protocol::ConfigStall{
+                  .key = cmd->key,
+                  .id = motor->addr,
+                  .abort = motor->stall_abort,
+              });
+        break;
+      }
+      default:
+        PRINT(REJ, SYS_CFG, NO_SUCH_KEY);
+      }
+    });
+    HANDLE_COMMAND(SET, SYS_CFG, Protocol::ConfigHeader, {
+      switch (cmd->key) {
+      case CFG_CHECKSUM: {
+        const auto cfg = frame.as<Protocol::ConfigChecksum>();
+        if (cfg == nullptr || cfg->mode > CRC16) {
+          PRINT(REJ, SYS_CFG, BAD_PAYLOAD);
+          break;
+        }
+        // Acknowledged in the current mode, the host must not send further
+        // frames until it receives the ACK and switches over.
+        REPLY(ACK, SYS_CFG, *cfg);
+        rx.integrity = tx.integrity = cfg->mode;
+        break;
+      }
+      case CFG_TRANSPORT: {
+        const auto cfg = frame.as<Protocol::ConfigTransport>();
+        if (cfg == nullptr || cfg->mode > TRANSPORT_STCP) {
+          PRINT(REJ, SYS_CFG, BAD_PAYLOAD);
+          break;
+        }
+        // Segments in flight cannot be handed back to the raw framing
+        if (tx.transport && cfg->mode == TRANSPORT_RAW) {
+          PRINT(REJ, SYS_CFG, TRANSPORT_LOCKED);
+          break;
+        }
+        // Same as CFG_CHECKSUM, the host switches once it has the ACK
+        REPLY(ACK, SYS_CFG, *cfg);
+        if (!tx.transport) {
+          Global::stcp.reset();
+          rx.transport = tx.transport = &Global::stcp;
+        }
+        break;
+      }
+      case CFG_LOG_LEVEL: {
+        const auto cfg = frame.as<Protocol::ConfigLogLevel>();
+        if (cfg == nullptr || cfg->level > Debug::VERBOSE) {
+          PRINT(REJ, SYS_CFG, BAD_PAYLOAD);
+          break;
+        }
+        Debug::verbosity = static_cast<Debug::Level>(cfg->level);
+        REPLY(ACK, SYS_CFG, *cfg);
+        break;
+      }
+      case CFG_ENDSTOP: {
+        const auto cfg = frame.as<Protocol::ConfigEndstop>();
+        if (cfg == nullptr ||
+            cfg->directions & ~(DIR_FORWARD | DIR_BACKWARD) ||
+            !Endstop::configure(*cfg)) {
+          PRINT(REJ, SYS_CFG, BAD_PAYLOAD);
+          break;
+        }
+        REPLY(ACK, SYS_CFG, *cfg);
+        break;
+      }
+      case CFG_STALL: {
+        const auto cfg = frame.as<Protocol::ConfigStall>();
+        const auto motor = cfg ? getMotorByID(cfg->id) : nullptr;
+        if (motor == nullptr) {
+          PRINT(REJ, SYS_CFG, cfg ? NO_SUCH_MOTOR : BAD_PAYLOAD);
+          break;
+        }
+        motor->stall_abort = cfg->abort;
+        REPLY(ACK, SYS_CFG, *cfg);
+        break;
+      }
+      default:
+        PRINT(REJ, SYS_CFG, NO_SUCH_KEY);
+      }
+    });
+    HANDLE_COMMAND(GET, MOT_STAT, Protocol::StatusHeader, {
+      switch (cmd->kind) {
+      case STATUS_POSITION: {
+        Protocol::MotorPosition status;
+        Motor::Scheduler::positions(status);
+        REPLY(ACK, MOT_STAT, status);
+        break;
+      }
+      case STATUS_DRIVER: {
+        Protocol::DriverStatus status;
+        Motor::health(status);
+        REPLY(ACK, MOT_STAT, status);
+        break;
+      }
+      default:
+        PRINT(REJ, MOT_STAT, BAD_PAYLOAD);
+      }
+    });
+    HANDLE_COMMAND(SET, MOT_STAT, Protocol::StatusStream, {
+      if (cmd->kind == STATUS_POSITION) {
+        position_period = cmd->period;
+      } else if (cmd->kind == STATUS_DRIVER) {
+        driver_period = cmd->period;
+      } else {
+        PRINT(REJ, MOT_STAT, BAD_PAYLOAD);
+        break;
+      }
+      REPLY(ACK, MOT_STAT, *cmd);
+    });
+    HANDLE_COMMAND(GET, SYS_STAT, Protocol::StatHeader, {
+      Protocol::Histogram stat;
+      if (Motor::Scheduler::stat(*cmd, stat, false)) {
+        REPLY(ACK, SYS_STAT, stat);
+      } else {
+        PRINT(REJ, SYS_STAT, NO_SUCH_STAT);
+      }
+    });
+    // Replies with the final snapshot before clearing the histogram
+    HANDLE_COMMAND(SET, SYS_STAT, Protocol::StatHeader, {
+      Protocol::Histogram stat;
+      if (Motor::Scheduler::stat(*cmd, stat, true)) {
+        REPLY(ACK, SYS_STAT, stat);
+      } else {
+        PRINT(REJ, SYS_STAT, NO_SUCH_STAT);
+      }
+    });
     HANDLE_COMMAND(GET, MOT_ENA, Protocol::MotorHeader, {
       MOTOR_COMMAND(MOT_ENA, {
         REPLY(ACK, MOT_ENA,
@@ -140,22 +434,229 @@ inline void processFrame(const Frame &frame) {
         }
       });
     });
-    HANDLE_COMMAND(SET, MOT_MOV, Protocol::MotorMove, {
-      MOTOR_COMMAND(MOT_MOV, {
+  case HEADER(SET, MOT_MOV): {
+    TRACE("SET::MOT_MOV");
+    // Payload carries one or more moves (any mix of motors), queued in one
+    // pass on an all-or-nothing basis. Only the last move of each motor
+    // carries the sequence, the frame is acknowledged once all of them have
+    // been picked up.
+    if (frame.payload_size > 0 && frame.payload[0] == MOVE_PACKED) {
+      queuePackedMoves(frame);
+      break;
+    }
+    constexpr auto MOVE_SIZE = sizeof(Protocol::MotorMove);
+    const auto moves = frame.as<Protocol::MotorMove>();
+    if (moves == nullptr || frame.payload_size % MOVE_SIZE != 0) {
+      PRINT(REJ, MOT_MOV, BAD_PAYLOAD);
+      break;
+    }
+    const unsigned count = frame.payload_size / MOVE_SIZE;
+    Motor::Motor *targets[Frame::PAYLOAD_SIZE / MOVE_SIZE];
+    unsigned slots[3] = {0, 0, 0};
+    const char *error = nullptr;
+    for (unsigned i = 0; i < count && !error; i++) {
+      auto motor = targets[i] = getMotorByID(moves[i].id);
+      if (!motor)
+        error = NO_SUCH_MOTOR;
+      else if (!motor->enabled)
+        error = MOTOR_DISABLED;
+      else
+        slots[motor->addr]++;
+    }
+    // Queue slots are shared by all motors
+    if (!error && count > Motor::arena.space())
+      error = MOTOR_QUEUE_FULL;
+    const uint16_t batch = error ? 0 : openBatch(slots, error);
+    if (error) {
+      PRINT(REJ, MOT_MOV, error);
+      break;
+    }
+    for (unsigned i = 0; i < count; i++) {
+      auto &motor = *targets[i];
+      const auto &move = moves[i];
+      const bool last = --slots[motor.addr] == 0;
+      const uint16_t part = last ? batch : 0;
+      // DEBUG("Motor%d %d steps @ %dus\n", motor.addr, move.steps,
+      // move.interval);
+      motor.pending.push(Motor::Command{last ? seq : Sequence(0), Motor::MOVE,
+                                        move.steps, {{move.interval, part}}});
+    }
+    Motor::Scheduler::wake();
+    // Delay ACK until the pending move is applied by ISR handler.
+    break;
+  }
+    HANDLE_COMMAND(SET, MOT_RMP, Protocol::MotorRamp, {
+      MOTOR_COMMAND(MOT_RMP, {
+        if (!motor->enabled) {
+          PRINT(REJ, MOT_RMP, MOTOR_DISABLED);
+          break;
+        }
+        if (!motor->pending.writable()) {
+          PRINT(REJ, MOT_RMP, MOTOR_QUEUE_FULL);
+          break;
+        }
+        Motor::Command command;
+        command.seq = seq;
+        command.kind = Motor::RAMP;
+        command.steps = cmd->steps;
+        command.ramp = Motor::Ramp::sanitize(cmd->profile);
+        motor->pending.push(command);
+        Motor::Scheduler::wake();
+        // Same as MOT_MOV, ACK is delayed until the ISR picks up the ramp.
+      });
+    });
+    HANDLE_COMMAND(SET, MOT_HOME, Protocol::MotorHome, {
+      MOTOR_COMMAND(MOT_HOME, {
+        if (cmd->travel == 0 || cmd->interval == 0 || cmd->backoff < 0) {
+          PRINT(REJ, MOT_HOME, BAD_PAYLOAD);
+          break;
+        }
         if (!motor->enabled) {
-          PRINT(REJ, MOT_MOV, MOTOR_DISABLED);
+          PRINT(REJ, MOT_HOME, MOTOR_DISABLED);
           break;
         }
         if (!motor->pending.writable()) {
-          PRINT(REJ, MOT_MOV, MOTOR_QUEUE_FULL);
+          PRINT(REJ, MOT_HOME, MOTOR_QUEUE_FULL);
+          break;
+        }
+        Motor::Command command;
+        command.seq = seq;
+        command.kind = Motor::HOME;
+        command.steps = cmd->travel;
+        command.home.interval = cmd->interval;
+        command.home.backoff = cmd->backoff;
+        motor->pending.push(command);
+        Motor::Scheduler::wake();
+        // ACK (MOT_MOV range) is delayed until the position is zeroed.
+      });
+    });
+  case HEADER(GET, MOT_PROG): {
+    TRACE("GET::MOT_PROG");
+    // Empty payload: program status, PROG_STORE: storage directory
+    const auto cmd = frame.as<Protocol::ProgramHeader>();
+    if (cmd == nullptr) {
+      REPLY(ACK, MOT_PROG, Program::status());
+    } else if (cmd->action == PROG_STORE) {
+      Protocol::ProgramDirectory directory;
+      Store::directory(directory);
+      REPLY(ACK, MOT_PROG, directory);
+    } else {
+      PRINT(REJ, MOT_PROG, BAD_PAYLOAD);
+    }
+    break;
+  }
+    HANDLE_COMMAND(SET, MOT_PROG, Protocol::ProgramHeader, {
+      const char *error = nullptr;
+      switch (cmd->action) {
+      case PROG_LOAD: {
+        constexpr auto SIZE = sizeof(Protocol::Instruction);
+        const auto load = frame.as<Protocol::ProgramLoad>();
+        const size_t bytes = frame.payload_size - sizeof(Protocol::ProgramLoad);
+        if (load == nullptr || bytes % SIZE != 0) {
+          error = BAD_PAYLOAD;
           break;
         }
-        // DEBUG("Motor%d %d steps @ %dus\n", motor->addr, cmd->steps,
-        // cmd->interval);
-        motor->pending.push(Motor::Command{seq, cmd->steps, cmd->interval});
-        // Delay ACK until the pending move is applied by ISR handler.
+        error = Program::load(
+            load->offset,
+            reinterpret_cast<const Protocol::Instruction *>(load + 1),
+            bytes / SIZE);
+        break;
+      }
+      case PROG_RUN: {
+        const auto run = frame.as<Protocol::ProgramRun>();
+        error = run ? Program::run(run->entry) : BAD_PAYLOAD;
+        break;
+      }
+      case PROG_STOP:
+        Program::stop(Protocol::END_STOPPED);
+        break;
+      case PROG_STORE: {
+        constexpr auto SIZE = sizeof(Protocol::Instruction);
+        const auto store = frame.as<Protocol::ProgramStore>();
+        const size_t bytes =
+            frame.payload_size - sizeof(Protocol::ProgramStore);
+        if (store == nullptr || bytes % SIZE != 0) {
+          error = BAD_PAYLOAD;
+          break;
+        }
+        error = Program::store(
+            store->slot, store->offset,
+            reinterpret_cast<const Protocol::Instruction *>(store + 1),
+            bytes / SIZE);
+        break;
+      }
+      case PROG_PLAY: {
+        const auto play = frame.as<Protocol::ProgramPlay>();
+        error = play ? Program::play(play->slot, play->entry) : BAD_PAYLOAD;
+        break;
+      }
+      case PROG_ERASE: {
+        const auto slot = frame.as<Protocol::ProgramSlot>();
+        error = slot ? Program::erase(slot->slot) : BAD_PAYLOAD;
+        break;
+      }
+      default:
+        error = BAD_PAYLOAD;
+      }
+      if (error) {
+        PRINT(REJ, MOT_PROG, error);
+        break;
+      }
+      REPLY(ACK, MOT_PROG, Program::status());
+    });
+    HANDLE_COMMAND(GET, MOT_QUE, Protocol::MotorHeader, {
+      MOTOR_COMMAND(MOT_QUE, { REPLY(ACK, MOT_QUE, motor->queueStatus()); });
+    });
+    HANDLE_COMMAND(SET, MOT_QUE, Protocol::MotorWatermark, {
+      MOTOR_COMMAND(MOT_QUE, {
+        const auto &wm = cmd->watermark;
+        if (wm.low > wm.high ||
+            wm.high > Motor::CAPACITY) {
+          PRINT(REJ, MOT_QUE, BAD_PAYLOAD);
+          break;
+        }
+        motor->watermark = wm;
+        motor->level = Motor::Motor::NORMAL;
+        REPLY(ACK, MOT_QUE, motor->queueStatus());
       });
     });
+  case HEADER(SET, BARRIER): {
+    TRACE("SET::BARRIER");
+    // Empty payload: plain barrier, acknowledged once released.
+    // Segment payload: barrier followed by a coordinated move, acknowledged
+    // once the move starts.
+    const auto segment = frame.as<Protocol::Segment>();
+    if (frame.payload_size != 0 &&
+        (segment == nullptr || !Motor::feasible(*segment))) {
+      PRINT(REJ, BARRIER, BAD_PAYLOAD);
+      break;
+    }
+    const unsigned slots = segment ? 2 : 1;
+    const char *error = nullptr;
+    uint8_t participants = 0;
+    unsigned needed = 0;
+    for (auto &motor : motors) {
+      if (!motor.enabled) {
+        if (segment && segment->steps[motor.addr] != 0)
+          error = MOTOR_DISABLED;
+        continue;
+      }
+      needed += slots;
+      participants |= 1 << motor.addr;
+    }
+    if (participants == 0)
+      error = MOTOR_DISABLED;
+    else if (!error && needed > Motor::arena.space())
+      error = MOTOR_QUEUE_FULL;
+    if (error) {
+      PRINT(REJ, BARRIER, error);
+      break;
+    }
+    // Acknowledged exactly once, through the first participant
+    Motor::barrier(participants, segment, seq);
+    Motor::Scheduler::wake();
+    break;
+  }
   default: {
     static char buffer[254];
     auto len = snprintf(buffer, sizeof(buffer), "Unsupported command: %s::%s",
@@ -183,8 +684,6 @@ inline void checkSerial() {
   }
 }
 
-extern uint32_t isr_active_cycles, isr_yield_cycles, isr_cycle_count;
-
 void agent(void *) {
   while (true) {
     TRACE("agentTick()");
@@ -195,24 +694,13 @@ void agent(void *) {
 }
 
 #define MOTOR_ACK(M)                                                           \
-  TRACE(#M ".done.readable()");                                                \
-  while (M.done.readable()) {                                                  \
-    TRACE(#M ".done.peek()");                                                  \
-    const auto &seq = M.done.peek();                                           \
-    REPLY(ACK, MOT_MOV);                                                       \
-    TRACE(#M ".done.peek()");                                                  \
-    M.done.pop();                                                              \
-    TRACE(#M ".done.readable()");                                              \
-  }                                                                            \
+  TRACE(#M ".acknowledge()");                                                  \
+  M.acknowledge();                                                             \
+  if (M.recover())                                                             \
+    Program::interrupted(M.addr);                                              \
+  M.checkWatermark();                                                          \
   TRACE(#M " [TX COMPLETE]");
 
-int serialAvailable() {
-  TRACE("serialAvailable() query");
-  int available = Serial.available();
-  TRACE("serialAvailable() done");
-  return available;
-}
-
 void agentTick() {
   // Feed hardware watchdog to prevent reset
   esp_task_wdt_reset();
@@ -220,52 +708,115 @@ void agentTick() {
   static constexpr unsigned REPORT_INTERVAL = 10000;
   if (millis() - last_report >= REPORT_INTERVAL) {
     last_report = millis();
-    const auto volatile active = isr_active_cycles;
-    const auto volatile yield = isr_yield_cycles;
-    const auto volatile count = isr_cycle_count;
-    isr_cycle_count = 0;
+    // Reported over the last interval, unless the host reset the histogram
+    static Histogram last = {};
+    Histogram isr;
+    Motor::Scheduler::stat({STAT_ISR_TIME, 0}, isr, false);
+    if (isr.count < last.count)
+      last.count = last.sum = 0;
+    const uint32_t count = isr.count - last.count;
+    const uint64_t active = isr.sum - last.sum;
+    last = isr;
     DEBUG(""
           "ISR %.2fKHz"
           ", "
-          "Active %u cycles"
+          "Active %u cycles avg, %u max"
           ", "
-          "Yield %u cycles (%.2f%%)"
+          "Load %.2f%%"
           "\n",
-          count / (float)REPORT_INTERVAL, active, yield,
-          100.0 * active / (active + yield));
+          count / (float)REPORT_INTERVAL,
+          count ? static_cast<uint32_t>(active / count) : 0, isr.max,
+          100.0 * active / (F_CPU / 1000.0 * REPORT_INTERVAL));
+    if (tx.dropped)
+      DEBUG("TX dropped %u frames (queue full)\n", tx.dropped);
+    if (tx.transport)
+      DEBUG("STCP retransmitted %u, duplicates %u\n",
+            Global::stcp.retransmitted, Global::stcp.duplicates);
     for (auto &motor : motors) {
       if (motor.enabled) {
         DEBUG("Motor %d [%d steps @ %u us] Pending=%u\n", motor.addr,
-              motor.steps, motor.interval, motor.pending.len());
+              motor.steps,
+              static_cast<uint32_t>(motor.interval >> Motor::FRACTION),
+              motor.pending.len());
       }
     }
   }
   TRACE("checkSerial()");
   checkSerial();
+  TRACE("Debug::flush()");
+  Debug::flush();
+  // Driver registers are kept in sync with or without a host
+  TRACE("TMC::poll()");
+  TMC::poll();
   if (!Serial) {
+    Program::stop(Protocol::END_DISCONNECTED);
     if (Board::Drv::is_enabled()) {
       Board::Drv::disable();
       for (auto &motor : motors)
         motor.disable();
     }
+    // Nobody to deliver to, and stale replies would confuse the next host
+    tx.reset();
+    // Next host starts over with the default framing and no streams
+    rx.integrity = tx.integrity = XOR;
+    rx.transport = tx.transport = nullptr;
+    position_period = driver_period = 0;
     return;
   }
+  // ACK ranges stop once TX runs short of room for replies, the commands
+  // picked up meanwhile stay in the arena until there is room again
   TRACE("Motor ACK TX");
   MOTOR_ACK(motors[0]);
   MOTOR_ACK(motors[1]);
   MOTOR_ACK(motors[2]);
-  while (serialAvailable() > 0) {
-    TRACE("Process RX");
-    if (!rx.valid) {
-      TRACE("rx.recv()");
-      rx.recv();
+  TRACE("Endstop::poll()");
+  Endstop::poll();
+  TRACE("Program::poll()");
+  Program::poll();
+  TRACE("Position stream");
+  static unsigned long last_position = 0;
+  if (position_period && millis() - last_position >= position_period) {
+    last_position = millis();
+    Protocol::MotorPosition status;
+    Motor::Scheduler::positions(status);
+    tx.send(0, Method::SYN, Property::MOT_STAT, status);
+  }
+  TRACE("Driver health stream");
+  // Each round reads the enabled drivers, the snapshot is sent once all of
+  // them are in (reads of a driver that went offline give up eventually)
+  static unsigned long last_health = 0;
+  // Motors still being read in the current round
+  static uint8_t round = 0;
+  static bool pending = false;
+  if (!pending && driver_period && millis() - last_health >= driver_period) {
+    last_health = millis();
+    pending = true;
+    for (auto &motor : motors) {
+      if (motor.enabled && motor.online()) {
+        motor.probe();
+        round |= 1 << motor.addr;
+      }
     }
-    TRACE("Check RX valid");
-    if (!rx.valid)
-      continue;
+  }
+  for (auto &motor : motors)
+    if (round & (1 << motor.addr) && motor.probed())
+      round &= ~(1 << motor.addr);
+  if (pending && !round) {
+    pending = false;
+    Protocol::DriverStatus status;
+    Motor::health(status);
+    tx.send(0, Method::SYN, Property::MOT_STAT, status);
+  }
+  TRACE("Process RX");
+  // Frames are decoded and processed in place, one chunk of input at a time.
+  // No request is taken in unless its replies are sure to fit, the host is
+  // held back by the serial port (or the STCP window) meanwhile. STCP
+  // segments keep being taken in, their ACKs are what frees the backlog.
+  while (rx.recv(tx.ready())) {
     TRACE("processFrame()");
     processFrame(rx.frame);
-    TRACE("Reset RX valid");
-    rx.valid = false;
   }
+  // Everything produced during this tick leaves in as few writes as possible
+  TRACE("tx.flush()");
+  tx.flush();
 }
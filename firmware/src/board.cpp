@@ -41,9 +41,9 @@ Switch SW[] = {
     {Pin(A1, INPUT_PULLDOWN), sw2_trigger_helper},
 };
 
-void sw0_trigger_helper() { SW[0].trigger(); }
-void sw1_trigger_helper() { SW[1].trigger(); }
-void sw2_trigger_helper() { SW[2].trigger(); }
+void IRAM_ATTR sw0_trigger_helper() { SW[0].trigger(); }
+void IRAM_ATTR sw1_trigger_helper() { SW[1].trigger(); }
+void IRAM_ATTR sw2_trigger_helper() { SW[2].trigger(); }
 
 Drv DRV[] = {
     {D8, D9, B0},
@@ -0,0 +1,106 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include "endstop.h"
+#include "board.h"
+#include "global.h"
+#include "motor.h"
+
+namespace Endstop {
+
+static constexpr unsigned COUNT = sizeof(Board::SW) / sizeof(Board::SW[0]);
+
+static Protocol::ConfigEndstop mappings[COUNT];
+// Motor of each mapped switch, nullptr if unmapped
+static Motor::Motor *volatile targets[COUNT];
+
+// Latched by the switch interrupt, reported by poll()
+static struct Event {
+  volatile bool pending;
+  bool active;
+  Steps position;
+} events[COUNT];
+
+// Guards mappings, events and blocked masks against the switch interrupt
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Recomputes the blocked directions of a motor from all switches mapped to
+// it, call with the lock held.
+static inline void IRAM_ATTR update(Motor::Motor &motor) {
+  uint8_t blocked = 0;
+  for (unsigned i = 0; i < COUNT; i++) {
+    if (targets[i] != &motor)
+      continue;
+    const bool level = Board::SW[i].level();
+    if (level != mappings[i].invert)
+      blocked |= mappings[i].directions;
+  }
+  motor.blocked = blocked;
+}
+
+static void IRAM_ATTR onChange(const Board::Switch &sw, bool level) {
+  const unsigned i = &sw - Board::SW;
+  portENTER_CRITICAL_ISR(&lock);
+  const auto motor = targets[i];
+  if (motor) {
+    update(*motor);
+    auto &event = events[i];
+    event.active = level != mappings[i].invert;
+    event.position = motor->position;
+    event.pending = true;
+  }
+  portEXIT_CRITICAL_ISR(&lock);
+}
+
+void init() {
+  for (unsigned i = 0; i < COUNT; i++) {
+    mappings[i] = {Protocol::CFG_ENDSTOP, static_cast<uint8_t>(i), 0, 0, false};
+    targets[i] = nullptr;
+    Board::SW[i].handler = onChange;
+  }
+}
+
+bool configure(const Protocol::ConfigEndstop &cfg) {
+  if (cfg.index >= COUNT)
+    return false;
+  const auto motor = getMotorByID(cfg.id);
+  if (!motor)
+    return false;
+  portENTER_CRITICAL(&lock);
+  const auto previous = targets[cfg.index];
+  mappings[cfg.index] = cfg;
+  targets[cfg.index] = cfg.directions ? motor : nullptr;
+  events[cfg.index].pending = false;
+  if (previous && previous != motor)
+    update(*previous);
+  update(*motor);
+  portEXIT_CRITICAL(&lock);
+  return true;
+}
+
+const Protocol::ConfigEndstop *config(uint8_t index) {
+  return index < COUNT ? &mappings[index] : nullptr;
+}
+
+void poll() {
+  for (unsigned i = 0; i < COUNT; i++) {
+    if (!events[i].pending)
+      continue;
+    portENTER_CRITICAL(&lock);
+    const Event event = events[i];
+    events[i].pending = false;
+    portEXIT_CRITICAL(&lock);
+    const Protocol::EndstopEvent report = {
+        .key = Protocol::CFG_ENDSTOP,
+        .index = static_cast<uint8_t>(i),
+        .id = mappings[i].id,
+        .active = event.active,
+        .position = event.position,
+    };
+    Global::tx.send(0, Protocol::Method::SYN, Protocol::Property::SYS_CFG,
+                    report);
+  }
+}
+
+} // namespace Endstop
@@ -7,18 +7,37 @@
 
 namespace IO {
 
-bool available() { return Serial.available() > 0; }
-char read() { return Serial.read(); }
+size_t read(void *buf, size_t size) {
+  const int available = Serial.available();
+  if (available <= 0)
+    return 0;
+  if (size > static_cast<size_t>(available))
+    size = available;
+  return Serial.read(static_cast<uint8_t *>(buf), size);
+}
 size_t write(const void *buf, size_t size) {
-  return Serial.write(static_cast<const char *>(buf), size);
+  const int space = Serial.availableForWrite();
+  if (space <= 0)
+    return 0;
+  if (size > static_cast<size_t>(space))
+    size = space;
+  return Serial.write(static_cast<const uint8_t *>(buf), size);
 }
 } // namespace IO
 
-Protocol::RX Global::rx(IO::available, IO::read);
+Protocol::RX Global::rx(IO::read);
 Protocol::TX Global::tx(IO::write);
 
+static uint32_t clock_ms() { return millis(); }
+STCP::Port Global::stcp(clock_ms);
+
 bool Global::Config::log = true;
 
 size_t debug_write(void *buf, size_t size) {
+  const int space = Serial2.availableForWrite();
+  if (space <= 0)
+    return 0;
+  if (size > static_cast<size_t>(space))
+    size = space;
   return Serial2.write(static_cast<const char *>(buf), size);
 }
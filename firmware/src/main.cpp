@@ -7,8 +7,10 @@
 #include "agent.h"
 #include "board.h"
 #include "debug.h"
+#include "endstop.h"
 #include "global.h"
 #include "motor.h"
+#include "store.h"
 #include <Arduino.h>
 #include <esp_task_wdt.h>
 
@@ -37,20 +39,17 @@ void blink(void *) {
 }
 
 void timer(void *) {
-  constexpr auto cpu_freq = 80; // MHz
-  constexpr auto interval = 10; // microseconds
-  constexpr auto divider = cpu_freq * interval;
-  auto timer = timerBegin(0, divider, true);
-  timerAttachInterrupt(timer, &motorTick, true);
-  timerAlarmWrite(timer, 1, true);
-  timerAlarmEnable(timer);
+  constexpr auto apb_freq = 80; // MHz
+  // Timer counts in microseconds, alarms are programmed by the scheduler for
+  // the next step deadline (the ISR is attached to the calling core).
+  Motor::Scheduler::begin(timerBegin(0, apb_freq, true));
   vTaskDelete(nullptr);
 }
 
 void pool(void *) {
   while (true) {
     // agentTick();
-    motorTick();
+    motorTick(Motor::Scheduler::now());
   }
 }
 
@@ -60,13 +59,16 @@ void rescue(const char *reason) {
   while (true) {
     Global::tx.send(0, Protocol::Method::LOG, Protocol::Property::NA, reason,
                     len);
-    debug_write((void *)reason, len);
-    DEBUG("Core 0 Trace: %s:%d (%s) %s\n", __trace_core0__.file,
-          __trace_core0__.line, __trace_core0__.func,
-          __trace_core0__.msg ? __trace_core0__.msg : "");
-    DEBUG("Core 1 Trace: %s:%d (%s) %s\n", __trace_core1__.file,
-          __trace_core1__.line, __trace_core1__.func,
-          __trace_core1__.msg ? __trace_core1__.msg : "");
+    Global::tx.flush();
+    DEBUG_ERROR("%s", reason);
+    DEBUG_ERROR("Core 0 Trace: %s:%d (%s) %s\n", __trace_core0__.file,
+                __trace_core0__.line, __trace_core0__.func,
+                __trace_core0__.msg ? __trace_core0__.msg : "");
+    DEBUG_ERROR("Core 1 Trace: %s:%d (%s) %s\n", __trace_core1__.file,
+                __trace_core1__.line, __trace_core1__.func,
+                __trace_core1__.msg ? __trace_core1__.msg : "");
+    // The agent is not running, drain the debug log here
+    Debug::flush();
     Board::LED::RED.write(HIGH);
     delay(200);
     Board::LED::RED.write(LOW);
@@ -81,6 +83,7 @@ void rescue(const char *reason) {
 void setup() {
   Serial.begin(Global::Config::SERIAL_BAUD_RATE);
   DebugSerialPort();
+  Debug::begin();
   switch (esp_reset_reason()) {
   case ESP_RST_UNKNOWN:
     DEBUG("Reset reason can not be determined\n");
@@ -112,6 +115,9 @@ void setup() {
   }
   Board::init();
   Motor::init();
+  Endstop::init();
+  // Formats the partition on first boot, before the watchdog is armed
+  Store::init();
   // Configure Task Watchdog Timer for agentTick
   // 1 second timeout - will reset to rescue mode if agentTick() freezes
   esp_task_wdt_init(1, true); // 1 second timeout, panic on timeout
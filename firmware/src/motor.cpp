@@ -3,15 +3,36 @@
 // Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
 // =============================================================================
 #include "board.h"
+#include <cmath>
 #include <motor.h>
 #include <numeric>
 
 #include "debug.h"
 
-uint32_t isr_active_cycles = 0, isr_yield_cycles = 0, isr_cycle_count = 0;
+// ISR timing, guarded by the scheduler lock
+static Stats::Histogram isr_time, isr_period;
+// Constructed ahead of the motors, whose queues take their first node here
+Motor::CommandArena Motor::arena;
 Motor::Motor motors[3] = {
     {Board::DRV[0], 0}, {Board::DRV[1], 1}, {Board::DRV[2], 2}};
 
+void IRAM_ATTR diag0_helper() { motors[0].stalled = true; }
+void IRAM_ATTR diag1_helper() { motors[1].stalled = true; }
+void IRAM_ATTR diag2_helper() { motors[2].stalled = true; }
+
+void Motor::init() {
+  Board::Drv::init();
+  Board::Drv::enable();
+  motors[0].init(diag0_helper);
+  motors[1].init(diag1_helper);
+  motors[2].init(diag2_helper);
+  // Learn which drivers are present and push the initial configuration,
+  // the agent keeps the bus going from here on
+  TMC::begin();
+  if (!TMC::flush(500))
+    DEBUG_WARN("TMC2209 setup incomplete\n");
+}
+
 #define TRACE_MOTOR(...)                                                       \
   do {                                                                         \
     switch (motor.addr) {                                                      \
@@ -27,82 +48,630 @@ Motor::Motor motors[3] = {
     }                                                                          \
   } while (0)
 
-void IRAM_ATTR motorTick() {
+// Load the command at the head of the pending queue into ISR state,
+// direction changes are collected into `dirs`
+static inline void IRAM_ATTR load(Motor::Motor &motor, Board::Batch &dirs) {
+  // TRACE_MOTOR("pending.peek()");
+  auto &cmd = motor.pending.peek();
+  // HOME is acknowledged once it completes, everything else once popped
+  if (cmd.kind == Motor::HOME)
+    motor.homing = cmd.seq;
+  motor.kind = cmd.kind;
+  motor.steps = cmd.steps;
+  switch (cmd.kind) {
+  case Motor::RAMP:
+    motor.interval = motor.ramp.load(cmd.ramp);
+    break;
+  case Motor::SEGMENT:
+    motor.interval =
+        Motor::fixed(motor.bresenham.load(cmd.steps, cmd.duration));
+    break;
+  case Motor::BARRIER:
+    motor.interval = 0;
+    break;
+  case Motor::HOME:
+    motor.interval = Motor::fixed(cmd.home.interval);
+    motor.backoff = cmd.home.backoff;
+    break;
+  default:
+    motor.interval = Motor::fixed(cmd.interval);
+  }
+  // TRACE_MOTOR("pending.pop()");
+  motor.pending.pop();
+  // Flip direction pin if needed, leave enough step hold time
+  // TRACE_MOTOR("setting direction");
+  const bool forward = motor.steps > 0;
+  if (motor.steps != 0 && forward != motor.forward) {
+    motor.forward = forward;
+    dirs.add(motor.dir, forward);
+    motor.run = 0;
+  }
+}
+
+// Stop the motor where it is, the agent takes over (Motor::recover())
+static inline void IRAM_ATTR halt(Motor::Motor &motor, Motor::Halt reason) {
+  motor.steps = 0;
+  motor.run = 0;
+  motor.kind = Motor::MOVE;
+  motor.halted = reason;
+}
+
+Micros IRAM_ATTR motorTick(Micros now) {
   TRACE("motorTick()");
-  static uint32_t tp0, tp1;
-  tp0 = ESP.getCycleCount();
-  isr_yield_cycles = tp0 - tp1;
-  const Micros now = micros();
+  const uint32_t t0 = ESP.getCycleCount();
+  // Tick period is only sampled while busy, idle gaps are not jitter
+  static Micros last_tick = 0;
+  static bool busy = false;
+  if (busy)
+    isr_period.add(static_cast<uint32_t>(now - last_tick));
+  last_tick = now;
+  // Bit masks of motors (by addr) that are enabled / holding at a barrier
+  uint8_t enabled = 0, arrived = 0;
+  // Step edges of all motors are emitted together, followed by direction
+  // changes for the next commands.
+  Board::Batch steps, dirs;
   for (auto &motor : motors) {
+    if (motor.enabled)
+      enabled |= 1 << motor.addr;
     // Skip motor if disabled or locked
     // TRACE_MOTOR("isAvailableForISR()");
     if (!motor.isAvailableForISR())
       continue;
+    if (motor.stopping) {
+      motor.stopping = false;
+      motor.waiting = false;
+      halt(motor, Motor::STOPPED);
+      continue;
+    }
+    if (motor.waiting) {
+      arrived |= 1 << motor.addr;
+      continue;
+    }
     // Execute pending motion
-    const auto elapsed = now - motor.last_step;
+    const Motor::Fixed elapsed = Motor::fixed(now) - motor.last_step;
     if (elapsed < motor.interval)
       continue;
-    motor.last_step = now;
-    // Generate step pulse if necessary
-    if (motor.steps > 0) {
-      // TRACE_MOTOR("step.toggle()");
-      motor.step.toggle();
-      motor.steps--;
+    // Advance by exactly one interval to keep step timing free of tick
+    // quantization drift (the fraction of a microsecond is carried to the
+    // next step), unless the motor has been idle for a while.
+    const bool on_time = elapsed < 2 * motor.interval;
+    if (on_time)
+      motor.last_step += motor.interval;
+    else
+      motor.last_step = Motor::fixed(now);
+    // StallGuard report, only trusted once the motor is up to speed
+    if (motor.stalled) {
+      motor.stalled = false;
+      const bool armed = motor.kind == Motor::HOME || motor.stall_abort;
+      if (armed && motor.steps != 0 &&
+          motor.run >= motor.blanking) {
+        if (motor.kind != Motor::HOME) {
+          halt(motor, Motor::STALL);
+          continue;
+        }
+        // Home found, reverse at the same rate and zero the position once
+        // backed off
+        motor.kind = Motor::BACKOFF;
+        motor.steps = motor.steps > 0 ? -motor.backoff : motor.backoff;
+        if (motor.steps != 0) {
+          motor.forward = !motor.forward;
+          dirs.add(motor.dir, motor.forward);
+          motor.run = 0;
+          continue;
+        }
+      }
     }
-    if (motor.steps < 0) {
-      // TRACE_MOTOR("step.toggle()");
-      motor.step.toggle();
-      motor.steps++;
+    // Generate step edge if necessary (driver steps on both edges)
+    if (motor.steps != 0) {
+      const uint8_t direction =
+          motor.steps > 0 ? Protocol::DIR_FORWARD : Protocol::DIR_BACKWARD;
+      if (motor.blocked & direction) {
+        // Endstop hit, drop the rest of this command and hold the motor
+        // until the agent has rejected the pending queue.
+        halt(motor, Motor::ENDSTOP);
+        continue;
+      }
+      if (on_time)
+        motor.lateness.add(static_cast<uint32_t>(
+            (elapsed - motor.interval) >> Motor::FRACTION));
+      motor.step_level = !motor.step_level;
+      steps.add(motor.step, motor.step_level);
+      motor.run++;
+      if (motor.steps > 0) {
+        motor.steps--;
+        motor.position = motor.position + 1;
+      } else {
+        motor.steps++;
+        motor.position = motor.position - 1;
+      }
     }
-    if (motor.steps != 0)
+    if (motor.steps != 0) {
+      if (motor.kind == Motor::RAMP)
+        motor.interval = motor.ramp.next(motor.interval);
+      else if (motor.kind == Motor::SEGMENT)
+        motor.interval = Motor::fixed(motor.bresenham.next());
       continue;
+    }
+    if (motor.kind == Motor::HOME) {
+      halt(motor, Motor::HOMING_FAILED);
+      continue;
+    }
+    if (motor.kind == Motor::BACKOFF) {
+      motor.kind = Motor::MOVE;
+      motor.position = 0;
+      motor.homing = 0;
+    }
     // Obtain next command, if available
     // TRACE_MOTOR("pending.readable()");
-    if (!motor.pending.readable())
+    if (!motor.pending.readable()) {
+      // Next command starts from rest
+      motor.run = 0;
+      continue;
+    }
+    if (motor.pending.peek().kind == Motor::BARRIER) {
+      // Hold here, barrier is resolved once all participants arrived
+      motor.waiting = true;
+      motor.run = 0;
+      arrived |= 1 << motor.addr;
       continue;
-    // TRACE_MOTOR("pending.peek()");
-    auto &cmd = motor.pending.peek();
-    // TRACE_MOTOR("done.writable()");
-    if (motor.done.writable()) {
-      // TRACE_MOTOR("done.push()");
-      motor.done.push(cmd.seq);
     }
-    motor.steps = cmd.steps;
-    motor.interval = cmd.interval;
-    // TRACE_MOTOR("pending.pop()");
-    motor.pending.pop();
-    // Flip direction pin if needed, leave enough step hold time
-    // TRACE_MOTOR("setting direction");
-    if (motor.steps > 0 && motor.dir.read() != HIGH)
-      motor.dir.write(HIGH);
-    if (motor.steps < 0 && motor.dir.read() != LOW)
-      motor.dir.write(LOW);
+    load(motor, dirs);
+  }
+  // Release barriers whose (still enabled) participants have all arrived.
+  // All of them are released within this tick and start on the same time
+  // base.
+  for (auto &motor : motors) {
+    if (!(arrived & (1 << motor.addr)))
+      continue;
+    const auto participants = motor.pending.peek().participants & enabled &
+                              ~Motor::Scheduler::detached;
+    if ((participants & arrived) != participants)
+      continue;
+    motor.waiting = false;
+    load(motor, dirs); // Pops the barrier (and acknowledges it if requested)
+    motor.last_step = Motor::fixed(now);
+    if (motor.pending.readable() &&
+        motor.pending.peek().kind != Motor::BARRIER)
+      load(motor, dirs);
+  }
+  steps.flush();
+  dirs.flush();
+  // Earliest deadline among motors with work left. Idle motors and motors
+  // holding at a barrier need no wake up, producers and the last barrier
+  // participant take care of them.
+  Micros next = Motor::Scheduler::IDLE;
+  for (auto &motor : motors) {
+    if (!motor.isAvailableForISR() || motor.waiting)
+      continue;
+    if (motor.steps == 0 && !motor.pending.readable())
+      continue;
+    const Micros deadline =
+        Motor::ceilMicros(motor.last_step + motor.interval);
+    if (deadline < next)
+      next = deadline;
   }
   TRACE("motorTick() complete");
-  tp1 = ESP.getCycleCount();
-  isr_active_cycles = tp1 - tp0;
-  isr_cycle_count++;
+  busy = next != Motor::Scheduler::IDLE;
+  isr_time.add(ESP.getCycleCount() - t0);
   TRACE_EXIT();
+  return next;
 };
 
+namespace Motor {
+namespace Scheduler {
+
+volatile uint8_t detached = 0;
+
+static hw_timer_t *timer = nullptr;
+// Currently programmed alarm
+static Micros alarm = IDLE;
+// Serializes alarm updates between the ISR (core 1) and producers (core 0),
+// so that a wake up can never be overwritten by a stale IDLE decision.
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline void IRAM_ATTR arm(Micros deadline) {
+  alarm = deadline;
+  if (deadline == IDLE) {
+    timerAlarmDisable(timer);
+    return;
+  }
+  const Micros earliest = timerRead(timer) + LEAD;
+  if (alarm < earliest)
+    alarm = earliest;
+  timerAlarmWrite(timer, alarm, false);
+  timerAlarmEnable(timer);
+}
+
+static void IRAM_ATTR isr() {
+  portENTER_CRITICAL_ISR(&lock);
+  arm(motorTick(timerRead(timer)));
+  portEXIT_CRITICAL_ISR(&lock);
+}
+
+void begin(hw_timer_t *t) {
+  timer = t;
+  timerAttachInterrupt(timer, &isr, true);
+  wake();
+}
+
+Micros now() { return timer ? timerRead(timer) : 0; }
+
+void wake() {
+  if (!timer)
+    return;
+  portENTER_CRITICAL(&lock);
+  if (alarm > timerRead(timer) + LEAD)
+    arm(0);
+  portEXIT_CRITICAL(&lock);
+}
+
+void sync() {
+  // The ISR holds the lock for a whole tick
+  portENTER_CRITICAL(&lock);
+  portEXIT_CRITICAL(&lock);
+}
+
+bool stat(const Protocol::StatHeader &which, Protocol::Histogram &out,
+          bool reset) {
+  Stats::Histogram *histogram = nullptr;
+  switch (which.kind) {
+  case Protocol::STAT_ISR_TIME:
+    histogram = &isr_time;
+    break;
+  case Protocol::STAT_ISR_PERIOD:
+    histogram = &isr_period;
+    break;
+  case Protocol::STAT_LATENESS: {
+    const auto motor = getMotorByID(which.id);
+    if (motor)
+      histogram = &motor->lateness;
+    break;
+  }
+  }
+  if (!histogram)
+    return false;
+  out.kind = which.kind;
+  out.id = which.id;
+  portENTER_CRITICAL(&lock);
+  histogram->read(out);
+  if (reset)
+    histogram->reset();
+  portEXIT_CRITICAL(&lock);
+  return true;
+}
+
+void positions(Protocol::MotorPosition &out) {
+  out.kind = Protocol::STATUS_POSITION;
+  portENTER_CRITICAL(&lock);
+  out.time = static_cast<uint32_t>(now());
+  for (auto &motor : motors) {
+    auto &axis = out.axes[motor.addr];
+    axis.position = motor.position;
+    const bool stepping = motor.isAvailableForISR() && !motor.waiting &&
+                          motor.steps != 0 && motor.interval != 0;
+    const int32_t rate =
+        stepping ? static_cast<int32_t>(fixed(1000000) / motor.interval) : 0;
+    axis.velocity = motor.steps > 0 ? rate : -rate;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+} // namespace Scheduler
+} // namespace Motor
+
+using Profile = Protocol::MotorRamp::Profile;
+
+Profile Motor::Ramp::sanitize(const Profile &profile) {
+  Profile p = profile;
+  // Slowest average rate over the first step starting from rest:
+  // s = a * t^2 / 2 (constant acceleration) or s = j * t^3 / 6 (jerk limited)
+  const float slowest = p.jerk ? cbrtf(p.jerk / 6.0f) : sqrtf(p.accel / 2.0f);
+  const Rate min = slowest > 1.0f ? static_cast<Rate>(slowest) : 1;
+  if (p.start < min)
+    p.start = min;
+  if (p.end < min)
+    p.end = min;
+  return p;
+}
+
+Motor::Fixed IRAM_ATTR Motor::Ramp::load(const Profile &profile) {
+  rate = static_cast<uint64_t>(profile.start) << SCALE;
+  target = static_cast<uint64_t>(profile.end) << SCALE;
+  limit = static_cast<uint64_t>(profile.accel) << SCALE;
+  jerk = profile.jerk;
+  // Jerk limited ramps build up acceleration from zero
+  accel = jerk ? 0 : limit;
+  return interval();
+}
+
+Motor::Fixed IRAM_ATTR Motor::Ramp::next(Fixed dt) {
+  if (rate == target)
+    return dt;
+  const uint64_t delta = rate < target ? target - rate : rate - target;
+  // dt [us, fixed point] in seconds << 31, i.e. dt * 2^23 / 1e6 by the
+  // rounded up reciprocal. Fits 32 bits as sanitize() keeps rates >= 1/s.
+  const uint32_t t = static_cast<uint64_t>(dt) * 36028797019ULL >> 32;
+  if (jerk) {
+    // jerk [steps/s^3] * t = change of acceleration
+    const uint64_t da = static_cast<uint64_t>(jerk) * t >> (31 - SCALE);
+    const uint32_t a = accel >> SCALE, d = delta >> SCALE;
+    // Ease off once the remaining rate change equals what is gained while
+    // ramping acceleration back down to zero: delta = a^2 / 2j
+    if ((static_cast<uint64_t>(a) * a >> 1) >= static_cast<uint64_t>(jerk) * d)
+      accel = accel > 2 * da ? accel - da : da;
+    else
+      accel = accel + da < limit ? accel + da : limit;
+  }
+  // accel * t = change of rate, accel exceeds 32 bits so multiply by halves
+  const uint64_t dv = ((accel >> 32) * t << 1) + ((accel & ~0U) * t >> 31);
+  if (dv >= delta)
+    rate = target;
+  else if (rate < target)
+    rate += dv;
+  else
+    rate -= dv;
+  return interval();
+}
+
+Motor::Fixed IRAM_ATTR Motor::Ramp::interval() const {
+  // fixed(1s) / (rate >> SCALE) = 1e6 * 2^32 / rate, with the divisor
+  // normalized to its top 32 bits: d = rate * 2^(z - 32).
+  static_assert(FRACTION + SCALE == 32, "interval is 1e6 * 2^32 / rate");
+  const unsigned z = __builtin_clzll(rate);
+  const uint32_t d = rate << z >> 32;
+  // r ~ 2^63 / d, a 32-bit divide by the top 16 bits of d gives 16 bits,
+  // one Newton-Raphson step r += r * (2^63 - d * r) / 2^63 gives 30 more.
+  uint64_t r = (0xFFFFFFFFULL / (d >> 16)) << 15;
+  const int64_t e = static_cast<int64_t>((1ULL << 63) - d * r) >> 31;
+  r += static_cast<int64_t>(r) * e >> 32;
+  // 1e6 * 2^32 / rate = 1e6 * 2^z / d = 1e6 * r / 2^(63 - z)
+  return 1000000ULL * r >> (63 - z);
+}
+
+Protocol::MotorQueue Motor::Motor::queueStatus() const {
+  return Protocol::MotorQueue{
+      .id = addr,
+      .queued = static_cast<uint16_t>(pending.len()),
+      .credits = static_cast<uint16_t>(arena.space()),
+      .capacity = CAPACITY,
+      .watermark = watermark,
+  };
+}
+
+Protocol::MotorRange Motor::Motor::rangeReport(uint16_t count) const {
+  return Protocol::MotorRange{
+      .tag = Protocol::MOTOR_RANGE,
+      .id = addr,
+      .count = count,
+      .queued = static_cast<uint16_t>(pending.len()),
+      .credits = static_cast<uint16_t>(arena.space()),
+  };
+}
+
+void Motor::Motor::checkWatermark() {
+  const auto queued = pending.len();
+  const auto current = queued < watermark.low    ? BELOW_LOW
+                       : queued > watermark.high ? ABOVE_HIGH
+                                                 : NORMAL;
+  if (current != level && current != NORMAL)
+    Global::tx.send(0, Protocol::Method::SYN, Protocol::Property::MOT_QUE,
+                    queueStatus());
+  level = current;
+}
+
+namespace Motor {
+namespace Batch {
+
+// Motors that have yet to settle their part (0 = free) and whether the frame
+// was rejected already, indexed by handle - 1. Each open batch has a part
+// queued somewhere, so there can never be more than CAPACITY of them.
+static struct {
+  uint8_t waiting;
+  bool rejected;
+} batches[CAPACITY];
+// Where to look for a free batch first
+static unsigned cursor = 0;
+
+uint16_t open(uint8_t motors) {
+  for (unsigned i = 0; i < CAPACITY; i++) {
+    const unsigned index = cursor;
+    cursor = (cursor + 1) % CAPACITY;
+    auto &batch = batches[index];
+    if (batch.waiting)
+      continue;
+    batch.waiting = motors;
+    batch.rejected = false;
+    return index + 1;
+  }
+  return 0;
+}
+
+bool settle(uint16_t handle, uint8_t addr, bool rejected) {
+  auto &batch = batches[handle - 1];
+  batch.waiting &= ~(1 << addr);
+  if (rejected) {
+    const bool first = !batch.rejected;
+    batch.rejected = true;
+    return first;
+  }
+  return !batch.rejected && batch.waiting == 0;
+}
+
+} // namespace Batch
+} // namespace Motor
+
+// Commands of a batch count (and end the range, so that the host sees the
+// sequence of the frame) only on the motor that settles the batch
+static inline bool counts(const Motor::Command &cmd, uint8_t addr,
+                          bool rejected) {
+  if (!cmd.seq)
+    return false;
+  if (cmd.kind != Motor::MOVE || !cmd.batch)
+    return true;
+  return Motor::Batch::settle(cmd.batch, addr, rejected);
+}
+
+void Motor::Motor::acknowledge(bool all) {
+  Sequence last = 0;
+  uint16_t count = 0;
+  const auto report = [&]() {
+    const Protocol::MotorRange range = rangeReport(count);
+    Global::tx.send(last, Protocol::Method::ACK, Protocol::Property::MOT_MOV,
+                    range);
+    count = 0;
+  };
+  while (all || Global::tx.ready()) {
+    const auto cmd = pending.completed();
+    if (!cmd)
+      break;
+    // Popped, but still in progress
+    if (cmd->kind == HOME && cmd->seq && cmd->seq == homing)
+      break;
+    const bool batch = cmd->kind == MOVE && cmd->batch;
+    const bool counted = counts(*cmd, addr, false);
+    if (counted) {
+      last = cmd->seq;
+      count++;
+    }
+    pending.release();
+    if (batch && counted)
+      report();
+  }
+  if (count)
+    report();
+}
+
+void Motor::Motor::flush(Protocol::HaltReason reason) {
+  // Pending commands are dropped from the consumer side, with the ISR kept
+  // off this motor meanwhile
+  lock = true;
+  Scheduler::sync();
+  // Commands the ISR picked up before are acknowledged, not rejected
+  acknowledge(true);
+  // A HOME in progress precedes everything still pending
+  Sequence last = homing;
+  uint16_t count = homing ? 1 : 0;
+  homing = 0;
+  while (pending.readable()) {
+    if (counts(pending.peek(), addr, true)) {
+      last = pending.peek().seq;
+      count++;
+    }
+    pending.pop();
+  }
+  lock = false;
+  // Everything popped is accounted for now, including the HOME above
+  while (pending.completed())
+    pending.release();
+  // Nothing else tells the host about a stall
+  if (count == 0 && reason != Protocol::HALT_STALL)
+    return;
+  __packed__ {
+    Protocol::MotorRange range;
+    Protocol::MotorHalt halt;
+  }
+  report = {rangeReport(count), {reason, position}};
+  Global::tx.send(last, Protocol::Method::REJ, Protocol::Property::MOT_MOV,
+                  report);
+}
+
+bool Motor::Motor::recover() {
+  const Halt reason = halted;
+  if (reason == RUNNING)
+    return false;
+  // The ISR leaves a halted motor alone, its state is safe to touch here
+  flush(static_cast<Protocol::HaltReason>(reason));
+  // Barriers queued before the halt were dropped with the queue
+  Scheduler::detached |= 1 << addr;
+  stopping = false;
+  halted = RUNNING;
+  Scheduler::wake();
+  return true;
+}
+
+void Motor::Motor::probe() {
+  driver.read(TMC::DRV_STATUS);
+  driver.read(TMC::SG_RESULT);
+  driver.read(TMC::TSTEP);
+}
+
+bool Motor::Motor::probed() const {
+  return driver.settled(TMC::DRV_STATUS) && driver.settled(TMC::SG_RESULT) &&
+         driver.settled(TMC::TSTEP);
+}
+
+void Motor::health(Protocol::DriverStatus &out) {
+  out.kind = Protocol::STATUS_DRIVER;
+  out.time = static_cast<uint32_t>(Scheduler::now());
+  out.online = 0;
+  for (auto &motor : motors) {
+    const auto &driver = motor.driver;
+    if (driver.online())
+      out.online |= 1 << motor.addr;
+    auto &status = out.drivers[motor.addr];
+    status.drv_status = driver.value(TMC::DRV_STATUS);
+    status.sg_result = driver.value(TMC::SG_RESULT);
+    status.tstep = driver.value(TMC::TSTEP);
+  }
+}
+
+void Motor::barrier(uint8_t participants, const Protocol::Segment *segment,
+                    Sequence seq) {
+  Scheduler::detached &= ~participants;
+  for (auto &motor : motors) {
+    if (!(participants & (1 << motor.addr)))
+      continue;
+    Command command;
+    command.seq = segment ? 0 : seq;
+    command.kind = BARRIER;
+    command.steps = 0;
+    command.participants = participants;
+    motor.pending.push(command);
+    if (segment) {
+      command.seq = seq;
+      command.kind = SEGMENT;
+      command.steps = segment->steps[motor.addr];
+      command.duration = segment->duration;
+      motor.pending.push(command);
+    }
+    seq = 0;
+  }
+}
+
+bool Motor::feasible(const Protocol::Segment &segment) {
+  for (const Steps steps : segment.steps) {
+    const uint64_t count = steps < 0 ? -static_cast<int64_t>(steps) : steps;
+    if (count * MIN_INTERVAL > segment.duration)
+      return false;
+  }
+  return true;
+}
+
 void Motor::Motor::updateConfig(const Protocol::MotorConfig::Config *cfg) {
+  using namespace TMC;
   if (cfg)
     config = *cfg;
-  // Blank time controls step timing, 0 = no blanking, 1-3 = 1us, 4-7 = 2us,
-  // etc.
-  driver.blank_time(2);
-  driver.rms_current(config.rms_current);
-  driver.microsteps(config.micro_steps);
-  driver.en_spreadCycle(false); // Toggle spreadCycle on TMC2208/2209/2224
-  driver.pwm_autoscale(true);   // Needed for stealthChop
-  driver.semin(5);
-  driver.semax(2);
-  driver.sedn(0b01);
-  driver.dedge(true); // Use both edges of STEP for stepping
+  uint32_t ihold_irun;
+  bool vsense;
+  current(config.rms_current, ihold_irun, vsense);
+  // micro_steps of 0 stands for 256
+  blanking = STALL_BLANKING * (config.micro_steps ? config.micro_steps : 256);
+  // UART controls microstepping and standstill current (PDN_DISABLE), and
+  // StealthChop stays on (no EN_SPREADCYCLE).
+  driver.write(GCONF, I_SCALE_ANALOG | PDN_DISABLE | MSTEP_REG_SELECT |
+                          MULTISTEP_FILT);
+  driver.write(IHOLD_IRUN, ihold_irun);
+  // Reset hysteresis, 32 clock blank time, step on both edges of STEP
+  driver.write(CHOPCONF, toff(energized ? 5 : 0) | hstrt(5) | hend(0) |
+                             tbl(2) | (vsense ? VSENSE : 0) |
+                             mres(resolution(config.micro_steps)) | INTPOL |
+                             DEDGE);
+  driver.write(PWMCONF, PWMCONF_DEFAULT);
+  // CoolStep current regulation
+  driver.write(COOLCONF, semin(5) | semax(2) | sedn(0b01));
   // DIAG is pulsed by StallGuard when SG_RESULT falls below SGTHRS. It is
   // only enabled in StealthChop mode, and when TCOOLTHRS ≥ TSTEP > TPWMTHRS
-  driver.TCOOLTHRS(0xFFFFF); // 20bit max
-  driver.TPWMTHRS(0x00000);  // 20bit max
-  driver.SGTHRS(config.stall_sensitivity);
-  driver.IOIN(); // Disable all IO pins
+  driver.write(TCOOLTHRS, 0xFFFFF); // 20bit max
+  driver.write(TPWMTHRS, 0x00000);  // 20bit max
+  driver.write(SGTHRS, config.stall_sensitivity);
 };
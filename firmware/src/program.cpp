@@ -0,0 +1,308 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include "program.h"
+#include "global.h"
+#include "motor.h"
+#include "store.h"
+
+namespace Program {
+
+using namespace Protocol;
+
+// Instructions handled per poll(), bounds the agent tick even if the program
+// spins without motion (e.g. a JUMP to itself)
+static constexpr unsigned BUDGET = 64;
+
+static Instruction code[CAPACITY];
+// Counted loops in progress, innermost last. Stored programs are too large
+// for a counter per instruction.
+static constexpr unsigned DEPTH = 16;
+static struct Loop {
+  uint16_t pc;   // LOOP instruction
+  uint16_t runs; // Completed runs of the body
+} loops[DEPTH];
+static unsigned depth = 0;
+static uint16_t size = 0, pc = 0;
+static bool running = false;
+// Program being run, PROGRAM_RAM or a storage slot read through `reader`
+static uint8_t source = PROGRAM_RAM;
+static uint16_t length = 0;
+static Store::Reader reader;
+// Motors sent motion by the current (or last) program
+static uint8_t driven = 0;
+static uint32_t issued = 0;
+
+static constexpr auto RUNNING = "Program running";
+static constexpr auto BAD_OFFSET = "Invalid program offset";
+static constexpr auto BAD_INSTRUCTION = "Invalid instruction";
+static constexpr auto BAD_TARGET = "Invalid jump target";
+static constexpr auto NO_PROGRAM = "No program";
+static constexpr auto NO_SUCH_SLOT = "No such slot";
+static constexpr auto READ_ERROR = "Read error";
+static constexpr auto MOVING = "Motors moving";
+
+// Flash writes mask the step timer interrupt, they are refused while any
+// motor has motion left
+static bool moving() {
+  for (auto &motor : motors)
+    if (motor.enabled && (motor.steps != 0 || motor.pending.readable()))
+      return true;
+  return false;
+}
+
+static void start(uint16_t entry) {
+  depth = 0;
+  pc = entry;
+  driven = 0;
+  issued = 0;
+  running = true;
+}
+
+static bool valid(const Instruction &op) {
+  switch (op.op) {
+  case OP_HALT:
+  case OP_JUMP:
+  case OP_LOOP:
+  case OP_DELAY:
+  case OP_SYNC:
+    return true;
+  case OP_SEGMENT:
+    return Motor::feasible(op.segment);
+  case OP_MOVE:
+    return getMotorByID(op.move.id) != nullptr;
+  default:
+    return false;
+  }
+}
+
+const char *load(uint16_t offset, const Instruction *instructions,
+                 unsigned count) {
+  if (running)
+    return RUNNING;
+  if ((offset != 0 && offset != size) || offset + count > CAPACITY)
+    return BAD_OFFSET;
+  for (unsigned i = 0; i < count; i++) {
+    Instruction op;
+    memcpy(&op, &instructions[i], sizeof(op));
+    if (!valid(op))
+      return BAD_INSTRUCTION;
+    code[offset + i] = op;
+  }
+  size = offset + count;
+  return nullptr;
+}
+
+const char *run(uint16_t entry) {
+  if (running)
+    return RUNNING;
+  if (entry >= size)
+    return size ? BAD_OFFSET : NO_PROGRAM;
+  // Targets are only known to be in range once the whole program is loaded
+  for (unsigned i = 0; i < size; i++) {
+    const auto &op = code[i];
+    if ((op.op == OP_JUMP || op.op == OP_LOOP) && op.jump.target >= size)
+      return BAD_TARGET;
+  }
+  source = PROGRAM_RAM;
+  length = size;
+  start(entry);
+  return nullptr;
+}
+
+const char *store(uint8_t slot, uint16_t offset, const Instruction *code,
+                  unsigned count) {
+  if (running && source == slot)
+    return RUNNING;
+  if (moving())
+    return MOVING;
+  for (unsigned i = 0; i < count; i++) {
+    Instruction op;
+    memcpy(&op, &code[i], sizeof(op));
+    if (!valid(op))
+      return BAD_INSTRUCTION;
+  }
+  return Store::write(slot, offset, code, count);
+}
+
+const char *play(uint8_t slot, uint16_t entry) {
+  if (running)
+    return RUNNING;
+  const uint16_t stored = Store::size(slot);
+  if (entry >= stored)
+    return stored ? BAD_OFFSET : NO_PROGRAM;
+  // Jump targets are checked as they are reached, the program may be too
+  // large to scan here
+  if (!reader.open(slot))
+    return READ_ERROR;
+  source = slot;
+  length = stored;
+  start(entry);
+  return nullptr;
+}
+
+const char *erase(uint8_t slot) {
+  if (running && source == slot)
+    return RUNNING;
+  if (moving())
+    return MOVING;
+  return Store::erase(slot) ? nullptr : NO_SUCH_SLOT;
+}
+
+static void end(ProgramEnd reason) {
+  running = false;
+  reader.close();
+  const ProgramEvent event = {status(), reason};
+  Global::tx.send(0, Method::SYN, Property::MOT_PROG, event);
+}
+
+void stop(ProgramEnd reason) {
+  for (auto &motor : motors)
+    if (driven & (1 << motor.addr))
+      motor.stop();
+  driven = 0;
+  if (running)
+    end(reason);
+}
+
+void interrupted(uint8_t addr) {
+  // Includes the halts requested by stop() itself, the program is over then
+  if (running && (driven & (1 << addr)))
+    stop(END_MOTOR_HALTED);
+}
+
+ProgramStatus status() {
+  return ProgramStatus{
+      .running = running,
+      .source = source,
+      .pc = pc,
+      .size = source == PROGRAM_RAM ? size : length,
+      .capacity = CAPACITY,
+      .issued = issued,
+  };
+}
+
+// Queue one instruction worth of motion. Returns false if the queues lack
+// room (or the program ended), to be retried on the next poll.
+static bool issue(const Instruction &op) {
+  if (op.op == OP_MOVE) {
+    const auto motor = getMotorByID(op.move.id);
+    if (!motor->enabled) {
+      stop(END_MOTOR_DISABLED);
+      return false;
+    }
+    if (!motor->pending.writable())
+      return false;
+    motor->pending.push(
+        Motor::Command{0, Motor::MOVE, op.move.steps, {{op.move.interval, 0}}});
+    driven |= 1 << motor->addr;
+    return true;
+  }
+  // DELAY is a segment without steps, SYNC a barrier without a segment
+  const Segment delay = {{0, 0, 0}, op.delay};
+  const Segment *segment = op.op == OP_SEGMENT ? &op.segment
+                           : op.op == OP_DELAY ? &delay
+                                               : nullptr;
+  const unsigned slots = segment ? 2 : 1;
+  uint8_t participants = 0;
+  unsigned needed = 0;
+  for (auto &motor : motors) {
+    if (!motor.enabled) {
+      if (segment && segment->steps[motor.addr] != 0) {
+        stop(END_MOTOR_DISABLED);
+        return false;
+      }
+      continue;
+    }
+    needed += slots;
+    participants |= 1 << motor.addr;
+  }
+  if (participants == 0) {
+    stop(END_MOTOR_DISABLED);
+    return false;
+  }
+  if (needed > Motor::arena.space())
+    return false;
+  Motor::barrier(participants, segment, 0);
+  driven |= participants;
+  return true;
+}
+
+// Count a pass through the LOOP at pc and move on, returns false if the
+// program ended
+static bool loop(const Instruction &op) {
+  if (op.jump.count == 0) {
+    pc = op.jump.target;
+    return true;
+  }
+  // Loops found above this one were left through a jump, they start over
+  // when reached again
+  unsigned i = 0;
+  while (i < depth && loops[i].pc != pc)
+    i++;
+  if (i == depth) {
+    if (depth == DEPTH) {
+      stop(END_TOO_DEEP);
+      return false;
+    }
+    loops[depth++] = {pc, 0};
+  }
+  depth = i + 1;
+  if (++loops[i].runs < op.jump.count) {
+    pc = op.jump.target;
+  } else {
+    depth = i;
+    pc++;
+  }
+  return true;
+}
+
+void poll() {
+  const uint32_t before = issued;
+  for (unsigned n = 0; n < BUDGET && running; n++) {
+    if (pc >= length) {
+      end(END_HALT);
+      break;
+    }
+    const auto fetched = source == PROGRAM_RAM ? &code[pc] : reader.fetch(pc);
+    if (!fetched) {
+      stop(END_READ_ERROR);
+      break;
+    }
+    const Instruction op = *fetched;
+    // Stored programs were checked when written, flash is checked again as
+    // it may hold programs written before a check was added
+    if (source != PROGRAM_RAM && !valid(op)) {
+      stop(END_BAD_INSTRUCTION);
+      break;
+    }
+    if ((op.op == OP_JUMP || op.op == OP_LOOP) && op.jump.target >= length) {
+      stop(END_BAD_TARGET);
+      break;
+    }
+    if (op.op == OP_HALT) {
+      end(END_HALT);
+      break;
+    }
+    if (op.op == OP_JUMP) {
+      pc = op.jump.target;
+      continue;
+    }
+    if (op.op == OP_LOOP) {
+      if (!loop(op))
+        break;
+      continue;
+    }
+    if (!issue(op))
+      break;
+    issued++;
+    pc++;
+  }
+  if (issued != before)
+    Motor::Scheduler::wake();
+  if (running && source != PROGRAM_RAM)
+    reader.prefetch();
+}
+
+} // namespace Program
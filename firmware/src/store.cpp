@@ -0,0 +1,147 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include "store.h"
+#include "debug.h"
+
+namespace Store {
+
+using Protocol::Instruction;
+
+static constexpr size_t SIZE = sizeof(Instruction);
+// Longest program addressable by a 16 bit program counter
+static constexpr uint32_t LIMIT = 0xFFFF;
+
+static constexpr auto NO_STORAGE = "No storage";
+static constexpr auto BAD_SLOT = "No such slot";
+static constexpr auto BAD_OFFSET = "Invalid program offset";
+static constexpr auto STORAGE_FULL = "Storage full";
+
+static bool mounted = false;
+// Instructions per slot, indexed at mount so that nothing is scanned later
+static uint16_t sizes[SLOTS];
+
+static inline void path(uint8_t slot, char (&out)[16]) {
+  snprintf(out, sizeof(out), "/prog-%02u", slot);
+}
+
+bool init() {
+  mounted = SPIFFS.begin(true);
+  if (!mounted) {
+    DEBUG_WARN("SPIFFS unavailable, program storage disabled\n");
+    return false;
+  }
+  for (uint8_t slot = 0; slot < SLOTS; slot++) {
+    char name[16];
+    path(slot, name);
+    File file = SPIFFS.exists(name) ? SPIFFS.open(name, FILE_READ) : File();
+    sizes[slot] = file ? file.size() / SIZE : 0;
+  }
+  return true;
+}
+
+const char *write(uint8_t slot, uint16_t offset, const Instruction *code,
+                  unsigned count) {
+  if (!mounted)
+    return NO_STORAGE;
+  if (slot >= SLOTS)
+    return BAD_SLOT;
+  if ((offset != 0 && offset != sizes[slot]) ||
+      static_cast<uint32_t>(offset) + count > LIMIT)
+    return BAD_OFFSET;
+  char name[16];
+  path(slot, name);
+  File file = SPIFFS.open(name, offset ? FILE_APPEND : FILE_WRITE);
+  if (!file)
+    return STORAGE_FULL;
+  const size_t bytes = count * SIZE;
+  const size_t written =
+      file.write(reinterpret_cast<const uint8_t *>(code), bytes);
+  // A partial write leaves whole instructions only, as far as they went
+  sizes[slot] = offset + written / SIZE;
+  file.close();
+  return written == bytes ? nullptr : STORAGE_FULL;
+}
+
+bool erase(uint8_t slot) {
+  if (!mounted || slot >= SLOTS)
+    return false;
+  char name[16];
+  path(slot, name);
+  if (sizes[slot] || SPIFFS.exists(name))
+    SPIFFS.remove(name);
+  sizes[slot] = 0;
+  return true;
+}
+
+uint16_t size(uint8_t slot) { return slot < SLOTS ? sizes[slot] : 0; }
+
+void directory(Protocol::ProgramDirectory &out) {
+  out.action = Protocol::PROG_STORE;
+  out.total = mounted ? SPIFFS.totalBytes() : 0;
+  out.used = mounted ? SPIFFS.usedBytes() : 0;
+  for (uint8_t slot = 0; slot < SLOTS; slot++)
+    out.sizes[slot] = mounted ? sizes[slot] : 0;
+}
+
+bool Reader::open(uint8_t slot) {
+  close();
+  if (!mounted || slot >= SLOTS || !sizes[slot])
+    return false;
+  char name[16];
+  path(slot, name);
+  file = SPIFFS.open(name, FILE_READ);
+  limit = sizes[slot];
+  return static_cast<bool>(file);
+}
+
+bool Reader::fill() {
+  const unsigned end = base + count;
+  if (end >= limit || count == WINDOW || !file)
+    return false;
+  // Up to the end of the ring, a chunk never wraps
+  unsigned n = CHUNK;
+  if (n > WINDOW - count)
+    n = WINDOW - count;
+  if (n > WINDOW - end % WINDOW)
+    n = WINDOW - end % WINDOW;
+  if (n > limit - end)
+    n = limit - end;
+  if (!file.seek(end * SIZE))
+    return false;
+  auto *const out = reinterpret_cast<uint8_t *>(&window[end % WINDOW]);
+  const unsigned read = file.read(out, n * SIZE) / SIZE;
+  count += read;
+  return read > 0;
+}
+
+const Instruction *Reader::fetch(uint16_t index) {
+  // Next one past the window, as if prefetch() had kept up
+  if (index == base + count)
+    prefetch();
+  if (index - base >= count) {
+    // Jumped out of the window, start over from here
+    base = index;
+    count = 0;
+    if (!fill())
+      return nullptr;
+  }
+  cursor = index;
+  return &window[index % WINDOW];
+}
+
+void Reader::prefetch() {
+  if (!file)
+    return;
+  const unsigned behind = cursor - base;
+  if (count == WINDOW && behind > WINDOW / 2) {
+    const unsigned drop =
+        behind - WINDOW / 2 < CHUNK ? behind - WINDOW / 2 : CHUNK;
+    base += drop;
+    count -= drop;
+  }
+  fill();
+}
+
+} // namespace Store
@@ -0,0 +1,284 @@
+// =============================================================================
+// License: MIT
+// Author: Yuxuan Zhang (zhangyuxuan@ufl.edu)
+// =============================================================================
+#include "tmc.h"
+#include "board.h"
+#include "debug.h"
+
+namespace TMC {
+
+Driver drivers[3] = {Driver(0), Driver(1), Driver(2)};
+
+// Datagram framing
+static constexpr uint8_t SYNC = 0x05;
+static constexpr uint8_t MASTER = 0xFF;
+static constexpr uint8_t WRITE = 0x80;
+// Time on the wire per byte (us), 8N1
+static constexpr unsigned long BYTE_TIME =
+    (10 * 1000000UL + Board::Drv::BAUD_RATE - 1) / Board::Drv::BAUD_RATE;
+// Slack for the UART to start transmitting and the driver to turn the bus
+// around (SENDDELAY is 8 bit times by default)
+static constexpr unsigned long SLACK = 200;
+// Time allowed for a reply to arrive after the request went out
+static constexpr unsigned long REPLY_TIMEOUT = 8 * BYTE_TIME + 1000;
+// Attempts per read before giving up on it
+static constexpr uint8_t ATTEMPTS = 3;
+// Interval of the background IOIN probe (ms)
+static constexpr unsigned long PROBE_INTERVAL = 1000;
+
+static const Register registers[Driver::SLOTS] = {
+    GCONF,    GSTAT,     IFCNT,     IOIN,     IHOLD_IRUN, TPOWERDOWN,
+    TSTEP,    TPWMTHRS,  TCOOLTHRS, SGTHRS,   SG_RESULT,  COOLCONF,
+    MSCNT,    CHOPCONF,  DRV_STATUS, PWMCONF,
+};
+
+int Driver::slot(uint8_t reg) {
+  for (unsigned i = 0; i < SLOTS; i++)
+    if (registers[i] == reg)
+      return i;
+  return -1;
+}
+
+void Driver::write(Register reg, uint32_t data) {
+  const int i = slot(reg);
+  if (i < 0)
+    return;
+  const uint16_t bit = 1U << i;
+  written |= bit;
+  if ((valid & bit) && shadow[i] == data)
+    return;
+  shadow[i] = data;
+  valid |= bit;
+  dirty |= bit;
+}
+
+void Driver::read(Register reg) {
+  const int i = slot(reg);
+  if (i >= 0)
+    requested |= 1U << i;
+}
+
+bool Driver::settled(Register reg) const {
+  const int i = slot(reg);
+  return i >= 0 && !((dirty | requested) & (1U << i));
+}
+
+uint32_t Driver::value(Register reg) const {
+  const int i = slot(reg);
+  return i >= 0 ? shadow[i] : 0;
+}
+
+void Driver::received(int i, uint32_t data) {
+  shadow[i] = data;
+  valid |= 1U << i;
+  requested &= ~(1U << i);
+  failures = 0;
+  if (registers[i] != IOIN)
+    return;
+  if ((data >> 24) != VERSION) {
+    link = DOWN;
+    return;
+  }
+  // A driver that was unreachable may have lost power, restore everything
+  // written to it so far
+  if (link == DOWN)
+    dirty |= written;
+  if (link != UP)
+    DEBUG("TMC2209 #%u online\n", addr);
+  link = UP;
+}
+
+void Driver::failed(int i) {
+  if (++failures < ATTEMPTS)
+    return; // Retried on the next poll
+  requested &= ~(1U << i);
+  failures = 0;
+  if (link != DOWN)
+    DEBUG_WARN("TMC2209 #%u offline\n", addr);
+  link = DOWN;
+}
+
+uint8_t resolution(uint16_t micro_steps) {
+  for (uint8_t mres = 0; mres <= 8; mres++)
+    if (micro_steps == 256U >> mres)
+      return mres;
+  return 0;
+}
+
+void current(uint16_t rms_current, uint32_t &ihold_irun, bool &vsense) {
+  // Same scaling as TMCStepper, full scale sense voltage is 0.325V, or
+  // 0.180V with VSENSE set (for better resolution at low currents)
+  const float peak = 32.0f * 1.41421f * rms_current / 1000.0f *
+                     (R_SENSE + 0.02f);
+  int cs = static_cast<int>(peak / 0.325f) - 1;
+  vsense = cs < 16;
+  if (vsense)
+    cs = static_cast<int>(peak / 0.180f) - 1;
+  if (cs > 31)
+    cs = 31;
+  if (cs < 0)
+    cs = 0;
+  ihold_irun = ihold(cs / 2) | irun(cs) | iholddelay(1);
+}
+
+static uint8_t crc(const uint8_t *data, size_t len) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t byte = data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      if ((sum >> 7) ^ (byte & 0x01))
+        sum = (sum << 1) ^ 0x07;
+      else
+        sum = sum << 1;
+      byte >>= 1;
+    }
+  }
+  return sum;
+}
+
+// Bus state, one transaction in flight
+static enum : uint8_t { IDLE, WRITING, READING } state = IDLE;
+static unsigned long deadline = 0;
+static Driver *active = nullptr;
+static int active_slot = 0;
+// Reply being assembled, the bus also echoes our own requests
+static uint8_t reply[8];
+static size_t filled = 0;
+// Round robin among drivers
+static unsigned turn = 0;
+static unsigned long last_probe = 0;
+
+static inline bool expired(unsigned long now) {
+  return static_cast<long>(now - deadline) >= 0;
+}
+
+// Collects the reply to the pending read, skipping echoes and noise.
+// Returns true once a full reply has arrived.
+static bool receive() {
+  auto &serial = Board::Drv::serial;
+  const uint8_t header[3] = {SYNC, MASTER, registers[active_slot]};
+  while (serial.available() > 0) {
+    const uint8_t byte = serial.read();
+    if (filled < sizeof(header) && byte != header[filled]) {
+      filled = byte == SYNC ? 1 : 0;
+      continue;
+    }
+    reply[filled++] = byte;
+    if (filled == sizeof(reply))
+      return true;
+  }
+  return false;
+}
+
+static void transmit(Driver &driver, int slot, bool write) {
+  auto &serial = Board::Drv::serial;
+  // Echoes of earlier writes are of no interest
+  while (serial.available() > 0)
+    serial.read();
+  const uint8_t reg = registers[slot];
+  uint8_t datagram[8] = {SYNC, driver.addr, reg};
+  size_t len = 3;
+  if (write) {
+    const uint32_t data = driver.value(registers[slot]);
+    datagram[2] |= WRITE;
+    datagram[len++] = data >> 24;
+    datagram[len++] = data >> 16;
+    datagram[len++] = data >> 8;
+    datagram[len++] = data;
+  }
+  datagram[len] = crc(datagram, len);
+  len++;
+  serial.write(datagram, len);
+  active = &driver;
+  active_slot = slot;
+  filled = 0;
+  state = write ? WRITING : READING;
+  deadline = micros() + len * BYTE_TIME + SLACK;
+  if (!write)
+    deadline += REPLY_TIMEOUT;
+}
+
+// Finishes the transaction in flight, returns false while it is not done
+static bool complete() {
+  const unsigned long now = micros();
+  switch (state) {
+  case IDLE:
+    return true;
+  case WRITING:
+    if (!expired(now))
+      return false;
+    break;
+  case READING:
+    if (receive()) {
+      const uint32_t data = static_cast<uint32_t>(reply[3]) << 24 |
+                            static_cast<uint32_t>(reply[4]) << 16 |
+                            static_cast<uint32_t>(reply[5]) << 8 | reply[6];
+      if (crc(reply, 7) == reply[7])
+        active->received(active_slot, data);
+      else
+        active->failed(active_slot);
+    } else if (expired(now)) {
+      active->failed(active_slot);
+    } else {
+      return false;
+    }
+    break;
+  }
+  state = IDLE;
+  return true;
+}
+
+static inline int lowest(uint16_t mask) {
+  return mask ? __builtin_ctz(mask) : -1;
+}
+
+void begin() {
+  for (auto &driver : drivers)
+    driver.read(IOIN);
+  last_probe = millis();
+}
+
+void poll() {
+  if (!complete())
+    return;
+  if (millis() - last_probe >= PROBE_INTERVAL) {
+    last_probe = millis();
+    for (auto &driver : drivers)
+      driver.read(IOIN);
+  }
+  // Writes take precedence over reads, drivers take turns
+  for (unsigned i = 0; i < 3; i++) {
+    auto &driver = drivers[(turn + i) % 3];
+    const int slot = lowest(driver.dirty);
+    if (slot < 0)
+      continue;
+    driver.dirty &= ~(1U << slot);
+    transmit(driver, slot, true);
+    turn = (turn + i + 1) % 3;
+    return;
+  }
+  for (unsigned i = 0; i < 3; i++) {
+    auto &driver = drivers[(turn + i) % 3];
+    const int slot = lowest(driver.requested);
+    if (slot < 0)
+      continue;
+    // Cleared once the reply arrived (or the read failed for good)
+    transmit(driver, slot, false);
+    turn = (turn + i + 1) % 3;
+    return;
+  }
+}
+
+bool flush(unsigned long timeout) {
+  const unsigned long start = millis();
+  while (millis() - start < timeout) {
+    poll();
+    if (state == IDLE && drivers[0].idle() && drivers[1].idle() &&
+        drivers[2].idle())
+      return true;
+  }
+  return false;
+}
+
+} // namespace TMC
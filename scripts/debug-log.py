@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# Decoder for the binary debug log (firmware/lib/debug/log.h).
+# Records only carry the address of their format string, which is looked up
+# in the firmware ELF the log was produced by:
+#   scripts/debug-log.py firmware/.pio/build/main/firmware.elf /dev/ttyUSB0
+#   .pio/build/native/program 2>&1 >/dev/null | \
+#       ../scripts/debug-log.py .pio/build/native/program
+
+import sys, os, re, stat, struct, argparse
+
+parser = argparse.ArgumentParser(description="Binary debug log decoder")
+parser.add_argument("elf", type=str, help="Firmware ELF the log comes from")
+parser.add_argument(
+    "source",
+    type=str,
+    nargs="?",
+    default=None,
+    help="Serial port or file to read from (default: stdin)",
+)
+parser.add_argument(
+    "-b", "--baud", type=int, default=115200, help="Baud rate of the serial port"
+)
+args = parser.parse_args()
+
+# Must match Debug::begin() in firmware/lib/debug/log.cpp
+MARKER = b"Debug log started, verbosity %u\n\0"
+LEVELS = ["SILENT", "ERROR", "WARN", "INFO", "VERBOSE"]
+ET_DYN = 3
+SHT_PROGBITS = 1
+SHF_ALLOC = 0x2
+
+
+class Image:
+    """Allocated sections of an ELF file, addressable by load address"""
+
+    def __init__(self, path: str):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF":
+            raise ValueError(f"{path} is not an ELF file")
+        wide = data[4] == 2
+        (self.type,) = struct.unpack_from("<H", data, 16)
+        if wide:
+            shoff, shentsize, shnum = (
+                struct.unpack_from("<Q", data, 0x28)[0],
+                *struct.unpack_from("<HH", data, 0x3A),
+            )
+            layout = "<IIQQQQ"
+        else:
+            shoff, shentsize, shnum = (
+                struct.unpack_from("<I", data, 0x20)[0],
+                *struct.unpack_from("<HH", data, 0x2E),
+            )
+            layout = "<IIIIII"
+        self.sections: list[tuple[int, bytes]] = []
+        for i in range(shnum):
+            _, kind, flags, addr, offset, size = struct.unpack_from(
+                layout, data, shoff + i * shentsize
+            )
+            if kind == SHT_PROGBITS and flags & SHF_ALLOC and addr:
+                self.sections.append((addr, data[offset : offset + size]))
+
+    def find(self, content: bytes) -> int | None:
+        for addr, data in self.sections:
+            index = data.find(content)
+            if index >= 0:
+                return addr + index
+        return None
+
+    def string(self, addr: int) -> str | None:
+        for base, data in self.sections:
+            if base <= addr < base + len(data):
+                end = data.find(b"\0", addr - base)
+                return data[addr - base : end].decode(errors="replace")
+        return None
+
+
+image = Image(args.elf)
+marker = image.find(MARKER)
+# Position independent builds are relocated, the offset is learned from the
+# start marker. Record addresses are truncated to 32 bits.
+bias = None if image.type == ET_DYN else 0
+
+
+def cobs_decode(frame: bytes) -> bytes:
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        if code == 0 or i + code > len(frame) + 1:
+            raise ValueError("Malformed COBS frame")
+        out += frame[i + 1 : i + code]
+        i += code
+        if code < 0xFF and i < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def parse_args(data: bytes) -> list:
+    values = []
+    i = 0
+    while i < len(data):
+        tag = chr(data[i])
+        i += 1
+        if tag in "iu":
+            (v,) = struct.unpack_from("<i" if tag == "i" else "<I", data, i)
+            i += 4
+        elif tag in "lL":
+            (v,) = struct.unpack_from("<q" if tag == "l" else "<Q", data, i)
+            i += 8
+        elif tag == "f":
+            (v,) = struct.unpack_from("<d", data, i)
+            i += 8
+        elif tag == "s":
+            v = data[i + 1 : i + 1 + data[i]].decode(errors="replace")
+            i += 1 + data[i]
+        elif tag == "b":
+            v = " ".join(f"{b:02X}" for b in data[i + 1 : i + 1 + data[i]])
+            i += 1 + data[i]
+        else:
+            raise ValueError(f"Unknown argument tag {tag!r}")
+        values.append(v)
+    return values
+
+
+SPEC = re.compile(
+    r"%([-+ #0]*)(\d+)?(?:\.(\d+))?(?:hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGcsp%])"
+)
+
+
+def format(fmt: str, values: list) -> str:
+    values = iter(values)
+
+    def convert(m: re.Match) -> str:
+        flags, width, precision, conv = m.groups()
+        if conv == "%":
+            return "%"
+        try:
+            v = next(values)
+        except StopIteration:
+            return "<?>"
+        if conv in "iu":
+            conv = "d"
+        elif conv == "p":
+            flags, conv = "#", "x"
+        elif conv == "c":
+            v = chr(v)
+            conv = "s"
+        spec = "%" + flags + (width or "") + (f".{precision}" if precision else "")
+        try:
+            return (spec + conv) % v
+        except TypeError:
+            return repr(v)
+
+    return SPEC.sub(convert, fmt)
+
+
+def decode(record: bytes) -> str:
+    global bias
+    if len(record) < 9:
+        raise ValueError("Record too short")
+    addr, time, info = struct.unpack_from("<IIB", record)
+    if bias is None and marker is not None:
+        # Relocation preserves the page offset, and the marker carries
+        # exactly one unsigned argument
+        if (addr - marker) & 0xFFF == 0 and len(record) == 14 and record[9] == 0x75:
+            bias = (addr - marker) & 0xFFFFFFFF
+    fmt = None
+    if bias is not None:
+        fmt = image.string((addr - bias) & 0xFFFFFFFF)
+    values = parse_args(record[9:])
+    if fmt is None:
+        text = f"<unknown format 0x{addr:08X}> {values}\n"
+    else:
+        text = format(fmt, values)
+    level = info & 0x7F
+    name = LEVELS[level] if level < len(LEVELS) else str(level)
+    return f"[{time / 1e6:12.6f}] C{info >> 7} {name:<7} {text.rstrip()}"
+
+
+def open_source():
+    if args.source is None:
+        return sys.stdin.buffer
+    if stat.S_ISCHR(os.stat(args.source).st_mode):
+        import serial
+
+        return serial.Serial(args.source, args.baud)
+    return open(args.source, "rb")
+
+
+def read(source) -> bytes:
+    if hasattr(source, "in_waiting"):
+        return source.read(source.in_waiting or 1)
+    return source.read1(4096)
+
+
+source = open_source()
+frame = bytearray()
+try:
+    while True:
+        chunk = read(source)
+        if not chunk:
+            break
+        for byte in chunk:
+            if byte != 0:
+                frame.append(byte)
+                continue
+            if not frame:
+                continue
+            try:
+                print(decode(cobs_decode(bytes(frame))), flush=True)
+            except (ValueError, struct.error) as e:
+                print(f"Bad record ({e}): {frame.hex(' ')}", file=sys.stderr)
+            frame.clear()
+except KeyboardInterrupt:
+    print()
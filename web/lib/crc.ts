@@ -0,0 +1,20 @@
+/* ---------------------------------------------------------
+ * Copyright (c) 2026 Yuxuan Zhang, web-dev@z-yx.cc
+ * This source code is licensed under the MIT license.
+ * You may find the full license in project root directory.
+ * ------------------------------------------------------ */
+
+// CRC-16/X-25 (reflected polynomial 0x1021), matches the firmware frame check
+const TABLE = Uint16Array.from({ length: 256 }, (_, i) => {
+  let crc = i;
+  for (let bit = 0; bit < 8; bit++)
+    crc = crc & 1 ? (crc >>> 1) ^ 0x8408 : crc >>> 1;
+  return crc;
+});
+
+export function crc16(data: ArrayLike<number>) {
+  let crc = 0xffff;
+  for (let i = 0; i < data.length; i++)
+    crc = (crc >>> 8) ^ TABLE[(crc ^ data[i]!) & 0xff]!;
+  return crc ^ 0xffff;
+}
@@ -4,9 +4,20 @@
  * You may find the full license in project root directory.
  * ------------------------------------------------------ */
 
-import { Method, Prop, Packet } from "./protocol";
+import {
+  Method,
+  Prop,
+  Packet,
+  Integrity,
+  ConfigKey,
+  StatusKind,
+  HaltReason,
+  ProgramEnd,
+  MOTOR_RANGE,
+} from "./protocol";
 import AsyncChain from "async-chain-list";
-import { bool } from "./stdint";
+import { bool, u8, u16 } from "./stdint";
+import { crc16 } from "./crc";
 import { hex, hexView } from "./util";
 import serial from "./serial";
 import createEvent from "./event";
@@ -29,6 +40,35 @@ class SyncMessage extends Map<string, string> {
   }
 }
 
+// Absolute position (steps) and velocity (steps/s) reported by the device
+export type Axis = { position: number; velocity: number };
+// Raw TMC2209 readings of a motor driver, see the datasheet for the fields
+export type DriverHealth = {
+  online: boolean;
+  drvStatus: number;
+  sgResult: number;
+  tstep: number;
+};
+
+// Limit switch state change, position is that of the mapped motor (steps)
+export type Endstop = {
+  index: number;
+  motor: number;
+  active: boolean;
+  position: number;
+};
+
+// Queue of a motor dropped, position is where the motor stopped (steps)
+export type Halt = { motor: number; reason: HaltReason; position: number };
+
+// Program run ended, pc is the next instruction it would have issued
+export type ProgramStop = {
+  source: number; // Storage slot, 0xff for the program in RAM
+  pc: number;
+  issued: number; // Motion commands queued by the run
+  reason: ProgramEnd;
+};
+
 class TimeoutError extends Error {
   name = "RequestTimeout";
   private end = Date.now();
@@ -63,41 +103,77 @@ class Driver extends SequencePool<Defer<Packet>, number> {
   public readonly onEnable = createEvent();
   public readonly onBeforeDisable = createEvent();
   public readonly onDisable = createEvent();
+  // Device time (us) and axes indexed by motor id, from the position stream
+  public readonly onPosition = createEvent<[time: number, axes: Axis[]]>();
+  // Device time (us) and driver readings indexed by motor id
+  public readonly onDriverStatus =
+    createEvent<[time: number, drivers: DriverHealth[]]>();
+  // Limit switch change, with the position of the motor it is mapped to
+  public readonly onEndstop = createEvent<[endstop: Endstop]>();
+  // Queue of a motor dropped, e.g. on a stall (reported even if empty)
+  public readonly onHalt = createEvent<[halt: Halt]>();
+  public readonly onProgramEnd = createEvent<[stop: ProgramStop]>();
 
   constructor() {
     super(new Set(Array.from({ length: 255 }, (_, i) => i + 1)));
-    serial.onConnect(() => this.enable(1000));
+    serial.onConnect(async () => {
+      // Device falls back to XOR whenever the port is closed
+      this.#integrity = Integrity.XOR;
+      await this.negotiate(Integrity.CRC16, 1000);
+      await this.streamPositions(Driver.POSITION_PERIOD, 1000);
+      await this.enable(1000);
+    });
     serial.onBeforeDisconnect(() => this.disable(1000));
     (async () => {
       // Read until next zero byte (which indicates end of packet)
       for await (const chunk of COBS.chunks(serial)) {
         try {
-          const decoded = COBS.decode(chunk);
-          if (decoded.length < 3)
-            throw new Error("Packet too short after COBS decoding");
-          // Verify CRC
-          const checksum = decoded.reduce((c, b) => c ^ b, 0);
-          if (checksum !== 0)
-            throw new Error(
-              `Invalid packet CRC: expected 0, got ${hex(checksum)}`,
-            );
+          let decoded = COBS.decode(chunk);
+          if (this.#integrity === Integrity.CRC16) {
+            if (decoded.length < 6)
+              throw new Error("Packet too short after COBS decoding");
+            const end = decoded.length - 2;
+            const crc = decoded[end]! | (decoded[end + 1]! << 8);
+            decoded = decoded.slice(0, end);
+            if (decoded[0] !== 0 || crc16(decoded) !== crc)
+              throw new Error(`Invalid packet CRC16: ${hex(crc)}`);
+          } else {
+            if (decoded.length < 3)
+              throw new Error("Packet too short after COBS decoding");
+            // Verify CRC
+            const checksum = decoded.reduce((c, b) => c ^ b, 0);
+            if (checksum !== 0)
+              throw new Error(
+                `Invalid packet CRC: expected 0, got ${hex(checksum)}`,
+              );
+          }
           const sequence = (decoded[2]! << 8) | decoded[1]!;
           const payload = decoded.slice(3);
           if (sequence === 0) {
             const packet = new Packet(payload);
+            if (this.updatePosition(packet)) continue;
+            if (this.updateDriverStatus(packet)) continue;
+            if (this.updateEndstop(packet)) continue;
+            if (this.updateProgram(packet)) continue;
             packet.print(`⬆ ${sequence.toString().padStart(6, " ")}`);
+            this.updateCredits(packet);
+            this.updateHalt(packet);
             this.rx = this.rx.push(packet);
           } else {
             const deferred = this.resolveSequence(sequence);
             try {
               const packet = new Packet(payload);
               packet.print(`⬆ ${sequence.toString().padStart(6, " ")}`);
+              this.updateCredits(packet);
+              this.updateHalt(packet);
+              this.settleMoves(sequence, packet);
+              this.updateIntegrity(packet);
               switch (packet.method) {
                 case Method.ACK:
                   deferred.resolve(packet);
                   break;
                 case Method.REJ:
-                  deferred.reject(new RejectedError(packet.text));
+                  deferred.reject(new RejectedError(Driver.reason(packet)));
                   break;
                 default:
                   console.warn(
@@ -129,11 +205,255 @@ class Driver extends SequencePool<Defer<Packet>, number> {
     })();
   }
 
+  // Outstanding MOT_MOV sequences per motor, in queue order. The device
+  // acknowledges (or rejects) queued moves cumulatively: a range frame for
+  // motor M carrying sequence N settles every move of M queued up to N.
+  // A frame with moves for several motors (a batch) is only settled by the
+  // ACK carrying its own sequence, sent once every motor picked up its part,
+  // or by any REJ covering it.
+  private readonly moves = new Map<number, number[]>();
+  private readonly batches = new Set<number>();
+
+  // Range frames lead with MOTOR_RANGE, plain rejections are text only
+  private static isRange(packet: Packet) {
+    const { payload } = packet;
+    return (
+      packet.prop === Prop.MOT_MOV &&
+      payload.length >= 8 &&
+      payload[0] === MOTOR_RANGE
+    );
+  }
+
+  // Free queue slots as last reported by the device, carried by range frames
+  // and MOT_QUE replies / watermark events. Slots are shared by all motors,
+  // so the latest report of any motor holds for all of them.
+  public credits = 0;
+
+  private updateCredits(packet: Packet) {
+    const { payload } = packet;
+    if (Driver.isRange(packet)) this.credits = payload[6]! | (payload[7]! << 8);
+    else if (packet.prop === Prop.MOT_QUE && payload.length >= 5)
+      this.credits = payload[3]! | (payload[4]! << 8);
+  }
+
+  // Frame integrity check in use, switched as soon as the device confirms
+  #integrity = Integrity.XOR;
+
+  private updateIntegrity(packet: Packet) {
+    const { payload } = packet;
+    if (
+      packet.method === Method.ACK &&
+      packet.prop === Prop.SYS_CFG &&
+      payload[0] === ConfigKey.CHECKSUM &&
+      payload.length >= 2
+    )
+      this.#integrity = payload[1] as Integrity;
+  }
+
+  // No other request may be in flight while switching
+  negotiate(integrity: Integrity, timeout?: number) {
+    return this.request(
+      Packet.encode(
+        Method.SET,
+        Prop.SYS_CFG,
+        u8(ConfigKey.CHECKSUM),
+        u8(integrity),
+      ),
+      timeout,
+    );
+  }
+
+  // Position stream period requested on connect (ms), the device stops the
+  // stream when the port is closed
+  static readonly POSITION_PERIOD = 20;
+
+  streamPositions(period: number, timeout?: number) {
+    return this.request(
+      Packet.encode(
+        Method.SET,
+        Prop.MOT_STAT,
+        u8(StatusKind.POSITION),
+        u16(period),
+      ),
+      timeout,
+    );
+  }
+
+  // Driver readings are not streamed unless requested (0 stops the stream),
+  // each round costs 9 register reads on the driver UART
+  streamDriverStatus(period: number, timeout?: number) {
+    return this.request(
+      Packet.encode(
+        Method.SET,
+        Prop.MOT_STAT,
+        u8(StatusKind.DRIVER),
+        u16(period),
+      ),
+      timeout,
+    );
+  }
+
+  // Dispatches SYN MOT_STAT driver frames, returns false for other packets
+  private updateDriverStatus(packet: Packet) {
+    const { payload } = packet;
+    if (
+      packet.method !== Method.SYN ||
+      packet.prop !== Prop.MOT_STAT ||
+      payload[0] !== StatusKind.DRIVER ||
+      payload.length < 36
+    )
+      return false;
+    const view = new DataView(payload.buffer, payload.byteOffset);
+    const online = payload[5]!;
+    const drivers = Array.from({ length: 3 }, (_, i) => ({
+      online: ((online >> i) & 1) === 1,
+      drvStatus: view.getUint32(6 + i * 10, true),
+      sgResult: view.getUint16(10 + i * 10, true),
+      tstep: view.getUint32(12 + i * 10, true),
+    }));
+    this.onDriverStatus.dispatch(view.getUint32(1, true), drivers);
+    return true;
+  }
+
+  // Dispatches SYN MOT_STAT position frames, returns false for other packets
+  private updatePosition(packet: Packet) {
+    const { payload } = packet;
+    if (
+      packet.method !== Method.SYN ||
+      packet.prop !== Prop.MOT_STAT ||
+      payload[0] !== StatusKind.POSITION ||
+      payload.length < 29
+    )
+      return false;
+    const view = new DataView(payload.buffer, payload.byteOffset);
+    const axes = Array.from({ length: 3 }, (_, i) => ({
+      position: view.getInt32(5 + i * 8, true),
+      velocity: view.getInt32(9 + i * 8, true),
+    }));
+    this.onPosition.dispatch(view.getUint32(1, true), axes);
+    return true;
+  }
+
+  // Dispatches SYN SYS_CFG endstop frames, returns false for other packets
+  private updateEndstop(packet: Packet) {
+    const { payload } = packet;
+    if (
+      packet.method !== Method.SYN ||
+      packet.prop !== Prop.SYS_CFG ||
+      payload[0] !== ConfigKey.ENDSTOP ||
+      payload.length < 8
+    )
+      return false;
+    const view = new DataView(payload.buffer, payload.byteOffset);
+    this.onEndstop.dispatch({
+      index: payload[1]!,
+      motor: payload[2]!,
+      active: payload[3] !== 0,
+      position: view.getInt32(4, true),
+    });
+    return true;
+  }
+
+  // Dispatches SYN MOT_PROG frames (ProgramStatus and a ProgramEnd),
+  // returns false for other packets
+  private updateProgram(packet: Packet) {
+    const { payload } = packet;
+    if (
+      packet.method !== Method.SYN ||
+      packet.prop !== Prop.MOT_PROG ||
+      payload.length < 13
+    )
+      return false;
+    const view = new DataView(payload.buffer, payload.byteOffset);
+    this.onProgramEnd.dispatch({
+      source: payload[1]!,
+      pc: view.getUint16(2, true),
+      issued: view.getUint32(8, true),
+      reason: payload[12]! as ProgramEnd,
+    });
+    return true;
+  }
+
+  // Range REJ frames are followed by a MotorHalt
+  private static halt(packet: Packet): Halt | undefined {
+    const { payload } = packet;
+    if (packet.method !== Method.REJ || !Driver.isRange(packet)) return;
+    if (payload.length < 13) return;
+    const view = new DataView(payload.buffer, payload.byteOffset);
+    return {
+      motor: payload[1]!,
+      reason: payload[8]! as HaltReason,
+      position: view.getInt32(9, true),
+    };
+  }
+
+  private updateHalt(packet: Packet) {
+    const halt = Driver.halt(packet);
+    if (halt) this.onHalt.dispatch(halt);
+  }
+
+  private static reason(packet: Packet) {
+    if (!Driver.isRange(packet)) return packet.text;
+    const halt = Driver.halt(packet);
+    return (halt && HaltReason[halt.reason]) || "Rejected";
+  }
+
+  private trackMoves(sequence: number, packet: Packet) {
+    if (packet.method !== Method.SET) return;
+    const { payload } = packet;
+    // Homing is queued (and settled) like a move, one 13 byte record
+    if (packet.prop === Prop.MOT_HOME && payload.length >= 13) {
+      const queue = this.moves.get(payload[0]!) ?? [];
+      queue.push(sequence);
+      this.moves.set(payload[0]!, queue);
+      return;
+    }
+    if (packet.prop !== Prop.MOT_MOV) return;
+    // Payload is one or more 9 byte MotorMove records
+    const motors = new Set<number>();
+    for (let i = 0; i + 9 <= payload.length; i += 9) {
+      const queue = this.moves.get(payload[i]!) ?? [];
+      if (!queue.includes(sequence)) queue.push(sequence);
+      this.moves.set(payload[i]!, queue);
+      motors.add(payload[i]!);
+    }
+    if (motors.size > 1) this.batches.add(sequence);
+  }
+
+  private untrackMoves(sequence: number) {
+    this.batches.delete(sequence);
+    for (const queue of this.moves.values()) {
+      const index = queue.indexOf(sequence);
+      if (index >= 0) queue.splice(index, 1);
+    }
+  }
+
+  // Settle moves covered by a range frame before its own sequence, the last
+  // one is settled through the regular sequence lookup. Batches covered by an
+  // ACK are only dropped from this motor, their own ACK settles them.
+  private settleMoves(sequence: number, packet: Packet) {
+    if (!Driver.isRange(packet)) return;
+    const queue = this.moves.get(packet.payload[1]!);
+    const end = queue?.indexOf(sequence) ?? -1;
+    if (!queue || end < 0) return;
+    for (const seq of queue.slice(0, end)) {
+      if (packet.method === Method.ACK && this.batches.has(seq)) {
+        queue.splice(queue.indexOf(seq), 1);
+        continue;
+      }
+      const deferred = this.resolveSequence(seq);
+      if (packet.method === Method.REJ)
+        deferred.reject(new RejectedError(Driver.reason(packet)));
+      else deferred.resolve(packet);
+    }
+  }
+
   request(packet: Packet, timeout?: number) {
     const deferred = defer<Packet>();
     const { promise, reject } = deferred;
     const sequence = this.assignSequence(deferred);
     packet.print(`⬇ ${sequence.toString().padStart(6, " ")}`);
+    this.trackMoves(sequence, packet);
     // Set up timeout if specified
     if (timeout !== undefined) {
       const error = new TimeoutError([sequence, packet].join(" "));
@@ -141,18 +461,28 @@ class Driver extends SequencePool<Defer<Packet>, number> {
       promise.finally(() => clearTimeout(handler));
     }
     // Catch-all to release sequence on promise settlement
-    promise.finally(() => this.releaseSequence(sequence, deferred));
+    promise.finally(() => {
+      this.untrackMoves(sequence);
+      this.releaseSequence(sequence, deferred);
+    });
     // Split u16 sequence into two u8 bytes
     const seq_l = sequence & 0xff;
     const seq_h = (sequence >> 8) & 0xff;
-    // Compute CRC byte
-    const crc = packet.reduce((c, b) => c ^ b, seq_l ^ seq_h);
+    const trailer = this.#integrity === Integrity.CRC16 ? 2 : 0;
     // Prefix with crc and sequence byte
-    const payload = new Uint8Array(packet.length + 3);
-    payload[0] = crc;
+    const payload = new Uint8Array(packet.length + 3 + trailer);
     payload[1] = seq_l; // Lower 8 bits
     payload[2] = seq_h; // Higher 8 bits
     payload.set(packet, 3);
+    if (trailer) {
+      // Checksum byte stays zero, CRC16 of the frame is appended
+      const crc = crc16(payload.subarray(0, payload.length - trailer));
+      payload[payload.length - 2] = crc & 0xff;
+      payload[payload.length - 1] = crc >> 8;
+    } else {
+      // Compute CRC byte
+      payload[0] = packet.reduce((c, b) => c ^ b, seq_l ^ seq_h);
+    }
     // Send via serial
     try {
       serial.write(COBS.encode(payload));
@@ -7,7 +7,7 @@
 import { reactive, ref, watch } from "vue";
 import { Method, Packet, Prop } from "./protocol";
 import { u8, u16, u32, i32 } from "./stdint";
-import driver from "./driver";
+import driver, { type Axis } from "./driver";
 import type { Local } from "./local";
 import local from "./local";
 import { type Motion, trapezoidal, discretize } from "./motion";
@@ -103,6 +103,21 @@ export default class Motor {
     return Number(this.#position_transient.value) / this.config.steps_per_unit;
   }
 
+  // Live position from the device stream, which counts absolute steps since
+  // power on. The origin is the device position at the host side zero.
+  #tracking = false;
+  #device_position = 0;
+  #origin: number | null = null;
+  private track({ position }: Axis) {
+    this.#tracking = true;
+    this.#device_position = position;
+    this.#origin ??= position;
+    const steps = position - this.#origin;
+    this.#position_transient.value = BigInt(
+      this.config.invert ? -steps : steps,
+    );
+  }
+
   #target = ref<number>(0); // units
   get target() {
     return this.#target.value;
@@ -181,12 +196,17 @@ export default class Motor {
         );
       },
     );
+    driver.onPosition((_, axes) => {
+      const axis = axes[this.id];
+      if (axis) this.track(axis);
+    });
     driver.onEnable(() => this.enable(1000));
     driver.onBeforeDisable(() => this.disable(1000));
     watch(this.#enabled, (en) => {
       if (!en) {
         this.#position.value = 0n;
         this.#target.value = 0;
+        this.#origin = this.#device_position;
       } else {
         this.plan();
       }
@@ -243,6 +263,7 @@ export default class Motor {
     this.#position.value = 0n;
     this.#target.value = 0;
     this.#position_transient.value = 0n;
+    this.#origin = this.#device_position;
     this.plan();
   }
 
@@ -282,7 +303,8 @@ export default class Motor {
       );
       await driver.request(packet, timeout + 10000);
       this.t_next_mot_ack = performance.now() + this.motion_delay;
-      this.#position_transient.value += delta;
+      // Otherwise follows the position stream
+      if (!this.#tracking) this.#position_transient.value += delta;
     } catch (e) {
       this.position_steps -= delta;
       this.target_steps -= delta;
@@ -32,12 +32,71 @@ export enum Prop {
   MOT_MOV = 0x4,
   MOT_HOME = 0x5,
   MOT_STAT = 0x6,
-  LED_PROG = 0xa,
+  MOT_RMP = 0x7,
+  MOT_QUE = 0x8,
+  SYS_STAT = 0x9,
+  MOT_PROG = 0xa,
   ODOM_SENSOR = 0xb,
   COLOR_SENSOR = 0xc,
+  SYS_CFG = 0xd,
+  BARRIER = 0xe,
   FW_INFO = 0xf,
 }
 
+// Frame integrity check, negotiated through SYS_CFG
+export enum Integrity {
+  // Header checksum byte is the XOR of all other bytes
+  XOR = 0x00,
+  // Header checksum byte is zero, frame is followed by its CRC-16 (LE)
+  CRC16 = 0x01,
+}
+
+// Framing below the protocol, negotiated through SYS_CFG. This client only
+// speaks RAW, STCP is implemented by the Python driver.
+export enum Transport {
+  RAW = 0x00,
+  STCP = 0x01,
+}
+
+export enum ConfigKey {
+  CHECKSUM = 0x01,
+  LOG_LEVEL = 0x02,
+  ENDSTOP = 0x03,
+  STALL = 0x04,
+  TRANSPORT = 0x05,
+}
+
+export enum StatusKind {
+  POSITION = 0x01,
+  DRIVER = 0x02,
+}
+
+// Why the queue of a motor was dropped, follows the range of a REJ
+export enum HaltReason {
+  ENDSTOP = 0x01,
+  STALL = 0x02,
+  HOMING_FAILED = 0x03,
+  STOPPED = 0x04, // Stopped by the program it belonged to
+  DISABLED = 0x05,
+}
+
+// Why a program ended, carried by the SYN MOT_PROG event
+export enum ProgramEnd {
+  HALT = 0x01,
+  STOPPED = 0x02,
+  DISCONNECTED = 0x03,
+  MOTOR_HALTED = 0x04, // A motor it drives was halted (see HaltReason)
+  MOTOR_DISABLED = 0x05,
+  READ_ERROR = 0x06,
+  BAD_INSTRUCTION = 0x07,
+  BAD_TARGET = 0x08,
+  TOO_DEEP = 0x09,
+}
+
+// Leads the payload of ACK / REJ MOT_MOV range frames (MotorRange), never the
+// first byte of the text carried by plain rejections
+export const MOTOR_RANGE = 0xfe;
+
 export class Packet extends Uint8Array {
   constructor(buffer: ArrayBuffer | ArrayLike<number>) {
     super(buffer);